@@ -0,0 +1,447 @@
+/**
+ * Implementation of the base 2 Fermat pseudo prime test of the mining sieve.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <gmp.h>
+
+#include "Fermat.h"
+
+#ifdef FERMAT_IFMA
+#include <immintrin.h>
+#endif
+
+/**
+ * returns the exponent bit at pos
+ */
+#define exp_bit(mod, pos) \
+  (((mod)[(pos) / GMP_NUMB_BITS] >> ((pos) % GMP_NUMB_BITS)) & 1)
+
+Fermat::Fermat(isa_t isa) {
+
+#ifdef FERMAT_IFMA
+  lanes = (isa == ISA_AVX512_IFMA) ? FERMAT_MAX_LANES : 1;
+#else
+  (void) isa;
+  lanes = 1;
+#endif
+
+  mpz_init(mpz_r);
+  mpz_init_set_ui(mpz_two, 2);
+
+  for (int i = 0; i < FERMAT_MAX_LANES; i++)
+    mpz_init(mpz_lanes[i]);
+
+  max_limbs = 0;
+  res       = NULL;
+  prod      = NULL;
+  num       = NULL;
+  quot      = NULL;
+}
+
+Fermat::~Fermat() {
+
+  mpz_clear(mpz_r);
+  mpz_clear(mpz_two);
+
+  for (int i = 0; i < FERMAT_MAX_LANES; i++)
+    mpz_clear(mpz_lanes[i]);
+
+  free(res);
+  free(prod);
+  free(num);
+  free(quot);
+}
+
+/**
+ * makes sure the scratch space fits n limb numbers
+ */
+void Fermat::reserve(mp_size_t n) {
+
+  if (n <= max_limbs)
+    return;
+
+  free(res);
+  free(prod);
+  free(num);
+  free(quot);
+
+  /* the start power 2^lead * R has up to 2^FERMAT_LEAD_BITS bits above R */
+  const mp_size_t lead_limbs = (1 << FERMAT_LEAD_BITS) / GMP_NUMB_BITS + 1;
+
+  max_limbs = n;
+  res  = (mp_limb_t *) malloc(sizeof(mp_limb_t) * n);
+  prod = (mp_limb_t *) malloc(sizeof(mp_limb_t) * 2 * n);
+  num  = (mp_limb_t *) malloc(sizeof(mp_limb_t) * (n + lead_limbs));
+  quot = (mp_limb_t *) malloc(sizeof(mp_limb_t) * (lead_limbs + 1));
+}
+
+/**
+ * tests the odd number mpz_p > 2
+ */
+bool Fermat::fermat_test(mpz_t mpz_p) {
+
+  const mp_size_t n = mpz_size(mpz_p);
+
+  if (n < FERMAT_BASE2_LIMBS) {
+
+    /* 2^p = 2 (mod p) is the same as 2^(p - 1) = 1 (mod p) for odd p */
+    mpz_powm(mpz_r, mpz_two, mpz_p, mpz_p);
+    return mpz_cmp_ui(mpz_r, 2) == 0;
+  }
+
+  reserve(n);
+  return base2_test(mpz_limbs_read(mpz_p), n);
+}
+
+/**
+ * Montgomery reduction r = t * R^-1 (mod mod) of the 2n limbs of t
+ * plus top * R^2 (t gets destroyed)
+ *
+ * With lazy reduction t has to be < mod * R, and r will only be < 2 mod,
+ * otherwise r is reduced completely.
+ */
+static inline void redc(mp_limb_t *r,
+                        mp_limb_t *t,
+                        mp_limb_t top,
+                        const mp_limb_t *mod,
+                        mp_limb_t ninv,
+                        mp_size_t n,
+                        bool lazy) {
+
+  /**
+   * clear t limb by limb from the lowest one, the carry out of
+   * each step belongs n limbs above and is kept in the cleared limb
+   */
+  for (mp_size_t i = 0; i < n; i++)
+    t[i] = mpn_addmul_1(t + i, mod, n, t[i] * ninv);
+
+  mp_limb_t carry = mpn_add_n(r, t + n, t, n) + top;
+
+  if (!lazy) {
+    while (carry || mpn_cmp(r, mod, n) >= 0)
+      carry -= mpn_sub_n(r, r, mod, n);
+  }
+}
+
+/**
+ * base 2 test of the n limbs mod: calculates 2^mod (mod mod) left to right
+ * with one Montgomery squaring per exponent bit, a set bit doubles the
+ * square before the reduction
+ */
+bool Fermat::base2_test(const mp_limb_t *mod, mp_size_t n) {
+
+  /* ninv = -mod^-1 mod 2^GMP_NUMB_BITS (newton iteration, mod is odd) */
+  mp_limb_t inv = mod[0];
+  for (int i = 0; i < 6; i++)
+    inv *= 2 - mod[0] * inv;
+
+  const mp_limb_t ninv = -inv;
+
+  /**
+   * with 8 mod < R the doubled square of a value < 2 mod is < mod * R,
+   * so the values can stay < 2 mod without any subtraction
+   */
+  const bool lazy = (mod[n - 1] >> (GMP_NUMB_BITS - 3)) == 0;
+
+  /* the exponent bits */
+  const mp_size_t bits = n * GMP_NUMB_BITS -
+                         (__builtin_clzll((unsigned long long) mod[n - 1]) -
+                          (64 - GMP_NUMB_BITS));
+
+  /* start with the leading exponent bits: res = 2^lead * R mod mod */
+  const mp_size_t pos = bits - FERMAT_LEAD_BITS;
+  mp_limb_t lead = mod[pos / GMP_NUMB_BITS] >> (pos % GMP_NUMB_BITS);
+
+  if (pos % GMP_NUMB_BITS + FERMAT_LEAD_BITS > GMP_NUMB_BITS)
+    lead |= mod[pos / GMP_NUMB_BITS + 1] <<
+            (GMP_NUMB_BITS - pos % GMP_NUMB_BITS);
+
+  lead &= (1 << FERMAT_LEAD_BITS) - 1;
+
+  const mp_size_t nn = n + 1 + lead / GMP_NUMB_BITS;
+  memset(num, 0, sizeof(mp_limb_t) * nn);
+  num[nn - 1] = ((mp_limb_t) 1) << (lead % GMP_NUMB_BITS);
+  mpn_tdiv_qr(quot, res, 0, num, nn, mod, n);
+
+  for (mp_size_t i = pos - 1; i >= 0; i--) {
+
+    mpn_sqr(prod, res, n);
+
+    mp_limb_t top = 0;
+    if (exp_bit(mod, i))
+      top = mpn_lshift(prod, prod, 2 * n, 1);
+
+    redc(res, prod, top, mod, ninv, n, lazy);
+  }
+
+  /* convert the result out of the Montgomery form */
+  memcpy(prod, res, sizeof(mp_limb_t) * n);
+  memset(prod + n, 0, sizeof(mp_limb_t) * n);
+  redc(res, prod, 0, mod, ninv, n, false);
+
+  /* 2^p = 2 (mod p) */
+  if (res[0] != 2)
+    return false;
+
+  for (mp_size_t i = 1; i < n; i++)
+    if (res[i] != 0)
+      return false;
+
+  return true;
+}
+
+/**
+ * tests the n <= get_lanes() odd numbers mpz_start + offsets[i] at once
+ */
+void Fermat::fermat_test(mpz_t mpz_start, 
+                         const uint64_t *offsets, 
+                         bool *results, 
+                         int n) {
+
+#ifdef FERMAT_IFMA
+  const mp_size_t lane_limbs = (mpz_sizeinbase(mpz_start, 2) + 5) / 
+                               FERMAT_LIMB_BITS + 1;
+
+  if (lanes > 1 && n > 1 && lane_limbs <= FERMAT_MAX_LANE_LIMBS) {
+
+    /* unused lanes repeat the first number */
+    for (int i = 0; i < FERMAT_MAX_LANES; i++)
+      mpz_add_ui(mpz_lanes[i], mpz_start, offsets[i < n ? i : 0]);
+
+    bool lane_results[FERMAT_MAX_LANES];
+    lanes_test(lane_results);
+
+    for (int i = 0; i < n; i++)
+      results[i] = lane_results[i];
+
+    return;
+  }
+#endif
+
+  for (int i = 0; i < n; i++) {
+    mpz_add_ui(mpz_lanes[0], mpz_start, offsets[i]);
+    results[i] = fermat_test(mpz_lanes[0]);
+  }
+}
+
+#ifdef FERMAT_IFMA
+/**
+ * the SIMD functions are build for AVX-512 IFMA regardless of the 
+ * compiler flags, they only run if the cpu supports it
+ */
+#define FERMAT_TARGET __attribute__((target("avx512f,avx512ifma")))
+
+typedef __m512i lane_t;
+
+#define lane_zero()       _mm512_setzero_si512()
+#define lane_set1(x)      _mm512_set1_epi64(x)
+#define lane_load(ptr)    _mm512_loadu_si512((const void *) (ptr))
+#define lane_add(a, b)    _mm512_add_epi64(a, b)
+#define lane_and(a, b)    _mm512_and_si512(a, b)
+
+/**
+ * the shifts as zero masking intrinsics with all lanes set: the same 
+ * instructions, but the plain intrinsics pass an undefined vector,
+ * which gcc 12 warns about (-Wmaybe-uninitialized)
+ */
+#define lane_srli(a, n)   _mm512_maskz_srli_epi64((__mmask8) -1, a, n)
+#define lane_slli(a, n)   _mm512_maskz_slli_epi64((__mmask8) -1, a, n)
+
+/**
+ * Montgomery multiplication r = a * b * 2^(-52 * L) mod m of 8 lanes with
+ * L limbs of 52 bits each, for a * b < m * 2^(52 * L) and 
+ * ninv = -m^-1 mod 2^52
+ *
+ * The products are accumulated unnormalized in 64 bit: each limb 
+ * receives at most 4 * L additions < 2^52, the low limb carry is
+ * propagated once per round.
+ */
+FERMAT_TARGET static inline void mont_mul(lane_t *r, 
+                            const lane_t *a, 
+                            const lane_t *b, 
+                            const lane_t *m, 
+                            lane_t ninv, 
+                            int L) {
+
+  lane_t t[2 * FERMAT_MAX_LANE_LIMBS + 1];
+  const lane_t zero = lane_zero();
+  const lane_t mask = lane_set1((1ULL << 52) - 1);
+
+  for (int k = 0; k <= 2 * L; k++)
+    t[k] = zero;
+
+  for (int i = 0; i < L; i++) {
+    lane_t *ti = t + i;
+
+    for (int j = 0; j < L; j++) {
+      ti[j]     = _mm512_madd52lo_epu64(ti[j],     a[j], b[i]);
+      ti[j + 1] = _mm512_madd52hi_epu64(ti[j + 1], a[j], b[i]);
+    }
+
+    const lane_t q = _mm512_madd52lo_epu64(zero, ti[0], ninv);
+
+    for (int j = 0; j < L; j++) {
+      ti[j]     = _mm512_madd52lo_epu64(ti[j],     q, m[j]);
+      ti[j + 1] = _mm512_madd52hi_epu64(ti[j + 1], q, m[j]);
+    }
+
+    ti[1] = lane_add(ti[1], lane_srli(ti[0], 52));
+  }
+
+  for (int j = 0; j < L; j++) {
+    r[j]         = lane_and(t[L + j], mask);
+    t[L + j + 1] = lane_add(t[L + j + 1], lane_srli(t[L + j], 52));
+  }
+}
+
+/**
+ * doubles r in the lanes where m has the given bit set
+ */
+FERMAT_TARGET static inline void lane_double(lane_t *r, lane_t m, uint64_t bit, int L) {
+
+  const __mmask8 set = _mm512_test_epi64_mask(m, lane_set1(bit));
+  if (set == 0)
+    return;
+
+  const lane_t mask = lane_set1((1ULL << 52) - 1);
+  for (int j = L - 1; j > 0; j--)
+    r[j] = _mm512_mask_mov_epi64(r[j], set, 
+           _mm512_or_si512(lane_and(lane_slli(r[j], 1), mask),
+                           lane_srli(r[j - 1], 51)));
+
+  r[0] = _mm512_mask_mov_epi64(r[0], set, 
+                               lane_and(lane_slli(r[0], 1), mask));
+}
+
+/**
+ * returns a bit mask of the lanes where r == 2
+ */
+FERMAT_TARGET static inline int lanes_two(const lane_t *r, int L) {
+
+  __mmask8 two = _mm512_cmpeq_epi64_mask(r[0], lane_set1(2));
+  for (int j = 1; j < L; j++)
+    two &= _mm512_cmpeq_epi64_mask(r[j], lane_zero());
+
+  return two;
+}
+
+/**
+ * stores the FERMAT_LIMB_BITS bit limbs of mpz_n into every
+ * FERMAT_MAX_LANES entry of limbs
+ */
+static void lane_limbs(uint64_t *limbs, mpz_t mpz_n, int L) {
+
+  const uint64_t mask = (1ULL << FERMAT_LIMB_BITS) - 1;
+
+  for (int j = 0; j < L; j++) {
+    const mp_size_t bit   = j * FERMAT_LIMB_BITS;
+    const mp_size_t shift = bit % GMP_NUMB_BITS;
+    uint64_t limb = mpz_getlimbn(mpz_n, bit / GMP_NUMB_BITS) >> shift;
+
+    if (shift + FERMAT_LIMB_BITS > GMP_NUMB_BITS)
+      limb |= mpz_getlimbn(mpz_n, bit / GMP_NUMB_BITS + 1) << 
+              (GMP_NUMB_BITS - shift);
+
+    limbs[j * FERMAT_MAX_LANES] = limb & mask;
+  }
+}
+
+/**
+ * the exponentiation of lanes_test: returns a bit mask of the lanes where
+ * 2^p = 2 (mod p), for the interleaved limbs of the lanes p and the start
+ * powers in Montgomery form 
+ */
+FERMAT_TARGET static int lanes_pow(const uint64_t *mod_limbs,
+                                   const uint64_t *res_limbs,
+                                   const uint64_t *ninvs,
+                                   mp_size_t pos,
+                                   int L) {
+
+  lane_t mod[FERMAT_MAX_LANE_LIMBS], res[FERMAT_MAX_LANE_LIMBS];
+  lane_t one[FERMAT_MAX_LANE_LIMBS];
+  const lane_t ninv = lane_load(ninvs);
+
+  for (int j = 0; j < L; j++) {
+    mod[j] = lane_load(mod_limbs + j * FERMAT_MAX_LANES);
+    res[j] = lane_load(res_limbs + j * FERMAT_MAX_LANES);
+    one[j] = lane_zero();
+  }
+  one[0] = lane_set1(1);
+
+  for (mp_size_t i = pos - 1; i >= 0; i--) {
+    mont_mul(res, res, res, mod, ninv, L);
+    lane_double(res, 
+                mod[i / FERMAT_LIMB_BITS], 
+                1ULL << (i % FERMAT_LIMB_BITS), 
+                L);
+  }
+
+  /* convert the result out of the Montgomery form, this gives res < p */
+  mont_mul(res, res, one, mod, ninv, L);
+
+  return lanes_two(res, L);
+}
+
+/**
+ * SIMD base 2 test of all lanes in mpz_lanes: the same left to right
+ * exponentiation as base2_test, with R = 2^(FERMAT_LIMB_BITS * L) > 16 p,
+ * so the values stay < 2 p after each reduction and < 4 p after doubling
+ */
+void Fermat::lanes_test(bool *results) {
+
+  size_t bits = 0;
+  for (int i = 0; i < FERMAT_MAX_LANES; i++)
+    if (mpz_sizeinbase(mpz_lanes[i], 2) > bits)
+      bits = mpz_sizeinbase(mpz_lanes[i], 2);
+
+  const int L = (bits + 4) / FERMAT_LIMB_BITS + 1;
+  const mp_size_t pos = bits - FERMAT_LEAD_BITS;
+
+  uint64_t mod_limbs[FERMAT_MAX_LANE_LIMBS * FERMAT_MAX_LANES];
+  uint64_t res_limbs[FERMAT_MAX_LANE_LIMBS * FERMAT_MAX_LANES];
+  uint64_t ninvs[FERMAT_MAX_LANES];
+
+  for (int i = 0; i < FERMAT_MAX_LANES; i++) {
+
+    /* -p^-1 mod 2^FERMAT_LIMB_BITS (newton iteration) */
+    const uint64_t p0 = mpz_getlimbn(mpz_lanes[i], 0);
+    uint64_t inv = p0;
+    for (int k = 0; k < 6; k++)
+      inv *= 2 - p0 * inv;
+
+    ninvs[i] = (-inv) & ((1ULL << FERMAT_LIMB_BITS) - 1);
+
+    /* start with the leading exponent bits: 2^lead * R mod p */
+    mpz_tdiv_q_2exp(mpz_r, mpz_lanes[i], pos);
+    const uint64_t lead = mpz_get_ui(mpz_r);
+
+    mpz_set_ui(mpz_r, 0);
+    mpz_setbit(mpz_r, FERMAT_LIMB_BITS * L + lead);
+    mpz_tdiv_r(mpz_r, mpz_r, mpz_lanes[i]);
+
+    lane_limbs(mod_limbs + i, mpz_lanes[i], L);
+    lane_limbs(res_limbs + i, mpz_r, L);
+  }
+
+  /* 2^p = 2 (mod p) */
+  const int two = lanes_pow(mod_limbs, res_limbs, ninvs, pos, L);
+  for (int i = 0; i < FERMAT_MAX_LANES; i++)
+    results[i] = (two >> i) & 1;
+}
+#endif
@@ -0,0 +1,143 @@
+/**
+ * Header file of the base 2 Fermat pseudo prime test of the mining sieve.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __FERMAT_H__
+#define __FERMAT_H__
+#include <inttypes.h>
+#include <stdint.h>
+#include <gmp.h>
+
+#include "Isa.h"
+
+/**
+ * numbers with at least this many limbs are tested with the base 2
+ * exponentiation, smaller ones with mpz_powm (whose assembly
+ * Montgomery reduction is faster there)
+ */
+#ifndef FERMAT_BASE2_LIMBS
+#define FERMAT_BASE2_LIMBS 12
+#endif
+
+/**
+ * number of leading exponent bits the base 2 exponentiation starts with
+ */
+#define FERMAT_LEAD_BITS 6
+
+/**
+ * maximal number of candidates tested at once by the batched test, each in
+ * its own 64 bit lane of 52 bit limbs (AVX-512 IFMA, used if the cpu 
+ * supports it). 
+ *
+ * There is no AVX2 variant: with its 32 x 32 bit multiplications 4 lanes
+ * are slower than one mpz_powm.
+ */
+#if defined(ISA_DISPATCH) && GMP_NUMB_BITS == 64
+#define FERMAT_IFMA
+#define FERMAT_MAX_LANES 8
+#define FERMAT_LIMB_BITS 52
+#else
+#define FERMAT_MAX_LANES 1
+#endif
+
+/**
+ * maximum number of lane limbs, larger batches are tested one by one
+ */
+#define FERMAT_MAX_LANE_LIMBS 64
+
+/**
+ * Fermat pseudo prime test to base 2: 2^(p - 1) = 1 (mod p)
+ *
+ * For base 2 the multiply step of a left to right exponentiation
+ * is a doubling, so the power is calculated by Montgomery squarings only,
+ * where the square is shifted one bit left for each set exponent bit
+ * before it gets reduced.
+ *
+ * The batched test runs the same exponentiation for get_lanes() numbers
+ * at once, with one SIMD lane per number.
+ */
+class Fermat {
+
+  public :
+
+    /**
+     * isa is the best instruction set that may be used
+     */
+    Fermat(isa_t isa = ISA_SCALAR);
+    ~Fermat();
+
+    /**
+     * tests the odd number mpz_p > 2
+     */
+    bool fermat_test(mpz_t mpz_p);
+
+    /**
+     * returns the number of candidates the batched test runs at once
+     */
+    int get_lanes() { return lanes; }
+
+    /**
+     * tests the n <= get_lanes() odd numbers mpz_start + offsets[i] 
+     * at once, results[i] tells whether mpz_start + offsets[i] passed
+     */
+    void fermat_test(mpz_t mpz_start, 
+                     const uint64_t *offsets, 
+                     bool *results, 
+                     int n);
+
+  private :
+
+    /* the number of SIMD lanes of the batched test */
+    int lanes;
+
+    /* mpz_powm values */
+    mpz_t mpz_r, mpz_two;
+
+    /* the numbers of a batch */
+    mpz_t mpz_lanes[FERMAT_MAX_LANES];
+
+    /* the number of limbs the scratch space is allocated for */
+    mp_size_t max_limbs;
+
+    /* the power (in Montgomery form) */
+    mp_limb_t *res;
+
+    /* double sized squares */
+    mp_limb_t *prod;
+
+    /* numerator and quotient of the start power */
+    mp_limb_t *num, *quot;
+
+    /**
+     * makes sure the scratch space fits n limb numbers
+     */
+    void reserve(mp_size_t n);
+
+    /**
+     * base 2 test of the n limbs mod
+     */
+    bool base2_test(const mp_limb_t *mod, mp_size_t n);
+
+#ifdef FERMAT_IFMA
+    /**
+     * SIMD base 2 test of all lanes in mpz_lanes
+     */
+    void lanes_test(bool *results);
+#endif
+};
+
+#endif /* __FERMAT_H__ */
@@ -0,0 +1,65 @@
+/**
+ * Implementation of the runtime instruction set selection of the mining kernels.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+
+#include "Isa.h"
+
+static const char *isa_names[] = { "scalar", "avx2", "avx512", "avx512ifma" };
+
+/**
+ * returns the best instruction set supported by this cpu,
+ * but not above the one given in ISA_ENV
+ */
+isa_t isa_detect() {
+
+  isa_t isa = ISA_SCALAR;
+
+#ifdef ISA_DISPATCH
+  __builtin_cpu_init();
+
+  if (__builtin_cpu_supports("avx2"))
+    isa = ISA_AVX2;
+
+  if (__builtin_cpu_supports("avx512f"))
+    isa = ISA_AVX512;
+
+  if (isa == ISA_AVX512 && __builtin_cpu_supports("avx512ifma"))
+    isa = ISA_AVX512_IFMA;
+#endif
+
+  const char *env = getenv(ISA_ENV);
+  if (env != NULL) {
+    for (int i = ISA_SCALAR; i < (int) isa; i++) {
+      if (strcmp(env, isa_names[i]) == 0) {
+        isa = (isa_t) i;
+        break;
+      }
+    }
+  }
+
+  return isa;
+}
+
+/**
+ * returns the name of the given instruction set
+ */
+const char *isa_name(isa_t isa) {
+  return isa_names[isa];
+}
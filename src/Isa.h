@@ -0,0 +1,57 @@
+/**
+ * Header file of the runtime instruction set selection of the mining kernels.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __ISA_H__
+#define __ISA_H__
+
+/**
+ * the SIMD kernels are build for all instruction sets (with target 
+ * attributes) and selected at runtime, this needs gcc or clang on x86-64
+ */
+#if defined(__GNUC__) && defined(__x86_64__)
+#define ISA_DISPATCH
+#endif
+
+/**
+ * environment variable to limit the selected instruction set,
+ * e.g. GAPCOIN_ISA=avx2 (one of the names of isa_name)
+ */
+#define ISA_ENV "GAPCOIN_ISA"
+
+/**
+ * the instruction set variants of the mining kernels (ascending)
+ */
+typedef enum {
+  ISA_SCALAR = 0,
+  ISA_AVX2,
+  ISA_AVX512,
+  ISA_AVX512_IFMA
+} isa_t;
+
+/**
+ * returns the best instruction set supported by this cpu,
+ * but not above the one given in ISA_ENV
+ */
+isa_t isa_detect();
+
+/**
+ * returns the name of the given instruction set
+ */
+const char *isa_name(isa_t isa);
+
+#endif /* __ISA_H__ */
@@ -0,0 +1,688 @@
+/**
+ * Implementation of a multi-threaded mining engine for Gapcoins PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "MiningEngine.h"
+
+/**
+ * adds x to the given statistic of a worker (only written by the worker)
+ */
+static inline void count(std::atomic<uint64_t> *counter, uint64_t x) {
+  counter->fetch_add(x, std::memory_order_relaxed);
+}
+
+/**
+ * thread entry point of a worker
+ */
+static void *mining_worker_main(void *args) {
+
+  mining_worker_t *worker = (mining_worker_t *) args;
+  worker->engine->run_worker(worker);
+
+  return NULL;
+}
+
+/**
+ * create a new MiningEngine
+ */
+MiningEngine::MiningEngine(PoWProcessor *pprocessor,
+                           uint32_t n_threads,
+                           uint64_t n_primes,
+                           uint64_t sievesize,
+                           sieve_layout_t layout) {
+
+  if (n_threads == 0) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n_threads   = (n_cpus > 0) ? n_cpus : 1;
+  }
+
+  this->n_threads       = n_threads;
+  this->n_sieve_threads = n_threads;
+  this->pipelined       = false;
+  this->pprocessor      = pprocessor;
+  this->stopped         = false;
+  this->queue_size      = 0;
+  this->queue_windows   = NULL;
+  this->free_windows    = NULL;
+  this->full_windows    = NULL;
+  this->n_free          = 0;
+  this->full_first      = 0;
+  this->n_full          = 0;
+  this->active_sieve_threads = 0;
+  this->start_time      = PoWUtils::gettime_usec();
+  this->end_time        = this->start_time;
+  this->workers         = new mining_worker_t[n_threads];
+  pthread_mutex_init(&mutex, NULL);
+  pthread_mutex_init(&queue_mutex, NULL);
+  pthread_cond_init(&queue_filled, NULL);
+  pthread_cond_init(&queue_freed, NULL);
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+    workers[i].engine  = this;
+    workers[i].id      = i;
+    workers[i].sieve   = new Sieve(this, n_primes, sievesize, layout);
+    workers[i].pow     = NULL;
+    workers[i].running = false;
+    workers[i].first   = 0;
+    workers[i].end     = 0;
+    workers[i].stolen  = false;
+    workers[i].owned_windows   = 0;
+    workers[i].stolen_windows  = 0;
+    workers[i].sieved_windows  = 0;
+    workers[i].scanned_windows = 0;
+    workers[i].sieve_time      = 0;
+    workers[i].scan_time       = 0;
+    pthread_mutex_init(&workers[i].lock, NULL);
+  }
+}
+
+MiningEngine::~MiningEngine() {
+
+  set_pipeline(0, 0);
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+    delete workers[i].sieve;
+    delete workers[i].pow;
+    pthread_mutex_destroy(&workers[i].lock);
+  }
+
+  delete[] workers;
+  pthread_mutex_destroy(&mutex);
+  pthread_mutex_destroy(&queue_mutex);
+  pthread_cond_destroy(&queue_filled);
+  pthread_cond_destroy(&queue_freed);
+}
+
+/**
+ * switches to the pipelined mode
+ */
+void MiningEngine::set_pipeline(uint32_t n_sieve_threads, uint32_t queue_size) {
+
+  stop();
+
+  for (uint32_t i = 0; i < this->queue_size; i++)
+    workers[0].sieve->clear_window(queue_windows + i);
+
+  free(queue_windows);
+  free(free_windows);
+  free(full_windows);
+  this->queue_windows = NULL;
+  this->free_windows  = NULL;
+  this->full_windows  = NULL;
+  this->queue_size    = 0;
+
+  this->pipelined = (n_sieve_threads > 0 && n_sieve_threads < n_threads);
+  if (!pipelined) {
+    this->n_sieve_threads = n_threads;
+    return;
+  }
+
+  /* each sieve thread needs a buffer to hand over its window */
+  if (queue_size == 0)
+    queue_size = 1;
+
+  this->n_sieve_threads = n_sieve_threads;
+  this->queue_size      = queue_size;
+  this->queue_windows   = (sieve_window_t *) malloc(sizeof(sieve_window_t) *
+                                                    queue_size);
+  this->free_windows    = (sieve_window_t **) malloc(sizeof(sieve_window_t *) *
+                                                     queue_size);
+  this->full_windows    = (sieve_window_t **) malloc(sizeof(sieve_window_t *) *
+                                                     queue_size);
+
+  for (uint32_t i = 0; i < queue_size; i++)
+    workers[0].sieve->init_window(queue_windows + i);
+}
+
+/**
+ * starts mining the given PoW
+ */
+void MiningEngine::start(PoW *pow) {
+
+  stop();
+  stopped = false;
+
+  /* the queue is empty */
+  n_full     = 0;
+  full_first = 0;
+  n_free     = queue_size;
+  active_sieve_threads = n_sieve_threads;
+
+  for (uint32_t i = 0; i < queue_size; i++)
+    free_windows[i] = queue_windows + i;
+
+  const uint16_t shift = pow->get_shift();
+  mpz_t mpz_hash, mpz_windows, mpz_tmp;
+  mpz_init(mpz_hash);
+  mpz_init(mpz_windows);
+  mpz_init(mpz_tmp);
+  pow->get_hash(mpz_hash);
+
+  /* number of sieve windows within [0, 2^shift) */
+  const uint64_t sievesize = workers[0].sieve->get_sievesize();
+  mpz_setbit(mpz_tmp, shift);
+  mpz_cdiv_q_ui(mpz_windows, mpz_tmp, sievesize);
+
+  /* (more than could ever be sieved for one block) */
+  uint64_t windows = TWO_POW48;
+  if (mpz_cmp_ui(mpz_windows, TWO_POW48) < 0)
+    windows = mpz_get_ui64(mpz_windows);
+
+  /** 
+   * sieve worker i starts with the windows 
+   * [windows * i / n, windows * (i + 1) / n) 
+   */
+  for (uint32_t i = 0; i < n_threads; i++) {
+    workers[i].first  = 0;
+    workers[i].end    = 0;
+    workers[i].stolen = false;
+
+    if (i < n_sieve_threads) {
+      workers[i].first = windows * i / n_sieve_threads;
+      workers[i].end   = windows * (i + 1) / n_sieve_threads;
+    }
+
+    workers[i].sieved_windows  = 0;
+    workers[i].scanned_windows = 0;
+    workers[i].sieve_time      = 0;
+    workers[i].scan_time       = 0;
+  }
+
+  start_time = PoWUtils::gettime_usec();
+  end_time   = 0;
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+
+    mining_worker_t *worker = workers + i;
+
+    delete worker->pow;
+    worker->pow = new PoW(mpz_hash,
+                          shift,
+                          NULL,
+                          pow->get_target(),
+                          pow->get_nonce());
+
+    /* the scan stage does not need the sieve residues */
+    if (i < n_sieve_threads)
+      worker->sieve->init_shift(shift);
+
+    worker->running = (pthread_create(&worker->thread,
+                                      NULL,
+                                      mining_worker_main,
+                                      worker) == 0);
+  }
+
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_windows);
+  mpz_clear(mpz_tmp);
+}
+
+/**
+ * stops all workers and waits for them
+ */
+void MiningEngine::stop() {
+  stop_workers();
+  wait();
+}
+
+/**
+ * sets stopped and wakes up all workers waiting for the queue
+ */
+void MiningEngine::stop_workers() {
+
+  pthread_mutex_lock(&queue_mutex);
+  stopped = true;
+  pthread_cond_broadcast(&queue_filled);
+  pthread_cond_broadcast(&queue_freed);
+  pthread_mutex_unlock(&queue_mutex);
+}
+
+/**
+ * waits till all workers have finished their range
+ */
+void MiningEngine::wait() {
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+    if (workers[i].running) {
+      pthread_join(workers[i].thread, NULL);
+      workers[i].running = false;
+    }
+  }
+
+  if (end_time == 0)
+    end_time = PoWUtils::gettime_usec();
+}
+
+/**
+ * runs the given worker
+ */
+void MiningEngine::run_worker(mining_worker_t *worker) {
+
+  if (!pipelined)
+    run_plain(worker);
+  else if (worker->id < n_sieve_threads)
+    run_sieve_stage(worker);
+  else
+    run_scan_stage(worker);
+}
+
+/**
+ * sieves and scans windows
+ */
+void MiningEngine::run_plain(mining_worker_t *worker) {
+
+  mpz_t mpz_offset;
+  mpz_init(mpz_offset);
+
+  const uint64_t sievesize = worker->sieve->get_sievesize();
+  uint64_t window;
+  bool stolen;
+
+  /* following windows are rolled from the last one by the Sieve */
+  while (!stopped && next_window(worker, &window, &stolen)) {
+
+    mpz_set_ui64(mpz_offset, window);
+    mpz_mul_ui(mpz_offset, mpz_offset, sievesize);
+
+    uint64_t time = PoWUtils::gettime_usec();
+    worker->sieve->sieve_window(worker->pow, mpz_offset);
+
+    uint64_t scan_start = PoWUtils::gettime_usec();
+    worker->sieve->scan_window(worker->pow, time);
+
+    count(&worker->sieve_time, scan_start - time);
+    count(&worker->scan_time, PoWUtils::gettime_usec() - scan_start);
+    count(&worker->sieved_windows, 1);
+    count(&worker->scanned_windows, 1);
+    count(stolen ? &worker->stolen_windows : &worker->owned_windows, 1);
+  }
+
+  mpz_clear(mpz_offset);
+}
+
+/**
+ * sieves windows and queues them
+ */
+void MiningEngine::run_sieve_stage(mining_worker_t *worker) {
+
+  mpz_t mpz_offset;
+  mpz_init(mpz_offset);
+
+  const uint64_t sievesize = worker->sieve->get_sievesize();
+  uint64_t window;
+  bool stolen;
+
+  while (!stopped && next_window(worker, &window, &stolen)) {
+
+    mpz_set_ui64(mpz_offset, window);
+    mpz_mul_ui(mpz_offset, mpz_offset, sievesize);
+
+    uint64_t time = PoWUtils::gettime_usec();
+    worker->sieve->sieve_window(worker->pow, mpz_offset);
+    count(&worker->sieve_time, PoWUtils::gettime_usec() - time);
+
+    /* wait for a free buffer */
+    pthread_mutex_lock(&queue_mutex);
+    while (n_free == 0 && !stopped)
+      pthread_cond_wait(&queue_freed, &queue_mutex);
+
+    if (stopped) {
+      pthread_mutex_unlock(&queue_mutex);
+      break;
+    }
+
+    sieve_window_t *buffer = free_windows[--n_free];
+    pthread_mutex_unlock(&queue_mutex);
+
+    /* swaps the window memory (no copy) */
+    worker->sieve->get_window(buffer);
+
+    pthread_mutex_lock(&queue_mutex);
+    full_windows[(full_first + n_full) % queue_size] = buffer;
+    n_full++;
+    pthread_cond_signal(&queue_filled);
+    pthread_mutex_unlock(&queue_mutex);
+
+    count(&worker->sieved_windows, 1);
+    count(stolen ? &worker->stolen_windows : &worker->owned_windows, 1);
+  }
+
+  /* let the scan stage finish if this was the last sieve thread */
+  pthread_mutex_lock(&queue_mutex);
+  active_sieve_threads--;
+  pthread_cond_broadcast(&queue_filled);
+  pthread_mutex_unlock(&queue_mutex);
+
+  mpz_clear(mpz_offset);
+}
+
+/**
+ * scans queued windows
+ */
+void MiningEngine::run_scan_stage(mining_worker_t *worker) {
+
+  for (;;) {
+
+    /* the Sieve accounts the waiting too, so that the summed up speed
+     * statistics of the scan threads are the one of the pipeline */
+    uint64_t time = PoWUtils::gettime_usec();
+
+    pthread_mutex_lock(&queue_mutex);
+    while (n_full == 0 && active_sieve_threads > 0 && !stopped)
+      pthread_cond_wait(&queue_filled, &queue_mutex);
+
+    if (n_full == 0 || stopped) {
+      pthread_mutex_unlock(&queue_mutex);
+      break;
+    }
+
+    sieve_window_t *buffer = full_windows[full_first];
+    full_first = (full_first + 1) % queue_size;
+    n_full--;
+    pthread_mutex_unlock(&queue_mutex);
+
+    worker->sieve->set_window(buffer);
+
+    pthread_mutex_lock(&queue_mutex);
+    free_windows[n_free++] = buffer;
+    pthread_cond_signal(&queue_freed);
+    pthread_mutex_unlock(&queue_mutex);
+
+    uint64_t scan_start = PoWUtils::gettime_usec();
+    worker->sieve->scan_window(worker->pow, time);
+
+    count(&worker->scan_time, PoWUtils::gettime_usec() - scan_start);
+    count(&worker->scanned_windows, 1);
+  }
+}
+
+/**
+ * takes the next window of the given worker, or steals some
+ */
+bool MiningEngine::next_window(mining_worker_t *worker, 
+                               uint64_t *window, 
+                               bool *stolen) {
+
+  do {
+    pthread_mutex_lock(&worker->lock);
+
+    const uint64_t first = worker->first.load(std::memory_order_relaxed);
+
+    if (first < worker->end.load(std::memory_order_relaxed)) {
+      *window = first;
+      *stolen = worker->stolen;
+      worker->first.store(first + 1, std::memory_order_relaxed);
+
+      pthread_mutex_unlock(&worker->lock);
+      return true;
+    }
+
+    pthread_mutex_unlock(&worker->lock);
+  } while (steal_windows(worker));
+
+  return false;
+}
+
+/**
+ * moves the back half of the fullest deque to the given one
+ */
+bool MiningEngine::steal_windows(mining_worker_t *thief) {
+  
+  for (;;) {
+
+    /**
+     * find the fullest deque (unlocked, so just a guess: first and end 
+     * may be from different updates, end may even be below first)
+     */
+    mining_worker_t *victim = NULL;
+    uint64_t max_windows = 0;
+
+    for (uint32_t i = 0; i < n_sieve_threads; i++) {
+
+      if (workers + i == thief)
+        continue;
+
+      const uint64_t first = workers[i].first.load(std::memory_order_relaxed);
+      const uint64_t end   = workers[i].end.load(std::memory_order_relaxed);
+
+      if (end > first && end - first > max_windows) {
+        victim = workers + i;
+        max_windows = end - first;
+      }
+    }
+
+    if (victim == NULL)
+      return false;
+
+    pthread_mutex_lock(&victim->lock);
+
+    /* the victim may have taken its last windows meanwhile */
+    const uint64_t end       = victim->end.load(std::memory_order_relaxed);
+    const uint64_t n_windows = end - 
+                               victim->first.load(std::memory_order_relaxed);
+    if (n_windows == 0) {
+      pthread_mutex_unlock(&victim->lock);
+      continue;
+    }
+
+    const uint64_t first = end - (n_windows + 1) / 2;
+    victim->end.store(first, std::memory_order_relaxed);
+
+    pthread_mutex_unlock(&victim->lock);
+
+    /* only the thief itself fills its (empty) deque */
+    pthread_mutex_lock(&thief->lock);
+    thief->first.store(first, std::memory_order_relaxed);
+    thief->end.store(end, std::memory_order_relaxed);
+    thief->stolen = true;
+    pthread_mutex_unlock(&thief->lock);
+
+    return true;
+  }
+}
+
+/**
+ * passes a found PoW of a worker to the PoWProcessor
+ */
+bool MiningEngine::process(PoW *pow) {
+
+  pthread_mutex_lock(&mutex);
+
+  /* the other workers may still find PoWs till they are stopped */
+  bool result = stopped || pprocessor->process(pow);
+
+  if (result)
+    stop_workers();
+
+  pthread_mutex_unlock(&mutex);
+  return result;
+}
+
+/**
+ * returns the number of worker threads
+ */
+uint32_t MiningEngine::get_n_threads() {
+  return n_threads;
+}
+
+/**
+ * returns the primes per seconds of all workers
+ */
+double MiningEngine::primes_per_sec() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->primes_per_sec();
+
+  return sum;
+}
+
+/**
+ * returns the average primes per seconds of all workers
+ */
+double MiningEngine::avg_primes_per_sec() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->avg_primes_per_sec();
+
+  return sum;
+}
+
+/**
+ * returns the prime gaps per second of all workers
+ */
+double MiningEngine::gaps_per_second() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->gaps_per_second();
+
+  return sum;
+}
+
+/**
+ * returns the average prime gaps per second of all workers
+ */
+double MiningEngine::avg_gaps_per_second() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->avg_gaps_per_second();
+
+  return sum;
+}
+
+/**
+ * returns the prime tests per second of all workers
+ */
+double MiningEngine::tests_per_second() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->tests_per_second();
+
+  return sum;
+}
+
+/**
+ * returns the average prime tests per second of all workers
+ */
+double MiningEngine::avg_tests_per_second() {
+
+  double sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->avg_tests_per_second();
+
+  return sum;
+}
+
+/**
+ * return the total number of found primes of all workers
+ */
+uint64_t MiningEngine::get_found_primes() {
+
+  uint64_t sum = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    sum += workers[i].sieve->get_found_primes();
+
+  return sum;
+}
+
+/**
+ * returns the time passed since the last start
+ */
+uint64_t MiningEngine::passed_time() {
+
+  uint64_t end = (end_time == 0) ? PoWUtils::gettime_usec() : end_time;
+  return (end > start_time) ? end - start_time : 1;
+}
+
+/**
+ * returns the windows per second the sieve stage finished
+ */
+double MiningEngine::sieve_windows_per_sec() {
+
+  uint64_t windows = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    windows += workers[i].sieved_windows.load(std::memory_order_relaxed);
+
+  return (((double) windows) * 1000000.0L) / ((double) passed_time());
+}
+
+/**
+ * returns the windows per second the scan stage finished
+ */
+double MiningEngine::scan_windows_per_sec() {
+
+  uint64_t windows = 0;
+  for (uint32_t i = 0; i < n_threads; i++)
+    windows += workers[i].scanned_windows.load(std::memory_order_relaxed);
+
+  return (((double) windows) * 1000000.0L) / ((double) passed_time());
+}
+
+/**
+ * returns the fraction of time the threads of the sieve stage were busy
+ */
+double MiningEngine::sieve_stage_load() {
+
+  uint64_t time = 0;
+  for (uint32_t i = 0; i < n_sieve_threads; i++)
+    time += workers[i].sieve_time.load(std::memory_order_relaxed);
+
+  return ((double) time) / (((double) passed_time()) * n_sieve_threads);
+}
+
+/**
+ * returns the fraction of time the threads of the scan stage were busy
+ */
+double MiningEngine::scan_stage_load() {
+
+  /* in the plain mode, all workers scan */
+  uint32_t first = pipelined ? n_sieve_threads : 0;
+
+  uint64_t time = 0;
+  for (uint32_t i = first; i < n_threads; i++)
+    time += workers[i].scan_time.load(std::memory_order_relaxed);
+
+  return ((double) time) / (((double) passed_time()) * (n_threads - first));
+}
+
+/**
+ * returns the number of windows the given worker sieved 
+ * from its own range
+ */
+uint64_t MiningEngine::get_owned_windows(uint32_t worker) {
+  return (worker < n_threads) ? 
+         workers[worker].owned_windows.load(std::memory_order_relaxed) : 0;
+}
+
+/**
+ * returns the number of windows the given worker sieved 
+ * from ranges stolen from other workers
+ */
+uint64_t MiningEngine::get_stolen_windows(uint32_t worker) {
+  return (worker < n_threads) ? 
+         workers[worker].stolen_windows.load(std::memory_order_relaxed) : 0;
+}
@@ -0,0 +1,318 @@
+/**
+ * Header file of a multi-threaded mining engine for Gapcoins PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __MINING_ENGINE_H__
+#define __MINING_ENGINE_H__
+#include <inttypes.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <gmp.h>
+#include <atomic>
+
+#include "PoW.h"
+#include "PoWProcessor.h"
+#include "Sieve.h"
+
+class MiningEngine;
+
+/**
+ * the state of one worker thread
+ */
+typedef struct {
+
+  /* the engine this worker belongs to */
+  MiningEngine *engine;
+
+  /* the index of this worker */
+  uint32_t id;
+
+  /* the sieve of this worker */
+  Sieve *sieve;
+
+  /* the PoW of this worker (hash, shift and target of the mined block) */
+  PoW *pow;
+
+  /**
+   * the window deque of this worker: the sieve windows [first, end),
+   * window k covers the adders [k * sievesize, (k + 1) * sievesize).
+   * The worker takes its windows from the front, idle workers steal
+   * from the back (written under lock, read without it when looking
+   * for the fullest deque).
+   */
+  std::atomic<uint64_t> first, end;
+
+  /* whether the windows of the deque were stolen from another worker */
+  bool stolen;
+
+  /* guards the deque */
+  pthread_mutex_t lock;
+
+  /**
+   * the statistics below are only written by the worker itself, 
+   * the getters of the engine read them with relaxed loads
+   */
+
+  /* number of sieved windows of the own and of stolen ranges */
+  std::atomic<uint64_t> owned_windows, stolen_windows;
+
+  /* number of sieved and scanned windows since the last start */
+  std::atomic<uint64_t> sieved_windows, scanned_windows;
+
+  /* time (usec) spent sieving and scanning since the last start */
+  std::atomic<uint64_t> sieve_time, scan_time;
+
+  /* whether the thread was started and has to be joined */
+  bool running;
+
+  pthread_t thread;
+} mining_worker_t;
+
+/**
+ * The engine is the PoWProcessor of all worker Sieves,
+ * it forwards their PoWs to its own PoWProcessor
+ */
+class MiningEngine : public PoWProcessor {
+
+  public :
+
+    /**
+     * create a new MiningEngine with n_threads workers
+     * (one per online cpu if n_threads is 0), each with its own Sieve
+     * of the given number of primes, sieve size and layout.
+     *
+     * The found PoWs of all workers are passed to pprocessor,
+     * one at a time.
+     */
+    MiningEngine(PoWProcessor *pprocessor,
+                 uint32_t n_threads,
+                 uint64_t n_primes,
+                 uint64_t sievesize,
+                 sieve_layout_t layout = SIEVE_ODD);
+
+    ~MiningEngine();
+
+    /**
+     * switches to the pipelined mode (taking effect with the next start):
+     * the first n_sieve_threads workers only sieve windows and pass them
+     * through a queue of queue_size windows to the other workers, which
+     * only scan them for prime gaps. So crossing off and fermat testing
+     * run at the same time.
+     *
+     * n_sieve_threads = 0 (or >= n_threads) switches back to the plain
+     * mode, where each worker sieves and scans its windows itself.
+     * A running mining is stopped.
+     */
+    void set_pipeline(uint32_t n_sieve_threads, uint32_t queue_size);
+
+    /**
+     * starts mining the given PoW (hash, shift and target),
+     * a running mining is stopped first.
+     *
+     * The adder range [0, 2^shift) is split into n_threads disjoint
+     * ranges of whole sieve windows, each worker sieves its range
+     * window by window. A worker with an empty range steals half 
+     * of the remaining windows of the fullest one. The workers 
+     * finish when all windows are sieved, stop is called or the
+     * PoWProcessor returns true.
+     */
+    void start(PoW *pow);
+
+    /**
+     * stops all workers (after their current window) and waits for them
+     */
+    void stop();
+
+    /**
+     * waits till all workers have finished their range
+     * (or were stopped by the PoWProcessor)
+     */
+    void wait();
+
+    /**
+     * returns the number of worker threads
+     */
+    uint32_t get_n_threads();
+
+    /**
+     * returns the primes per seconds of all workers
+     */
+    double primes_per_sec();
+
+    /**
+     * returns the average primes per seconds of all workers
+     */
+    double avg_primes_per_sec();
+
+    /**
+     * returns the prime gaps per second of all workers
+     */
+    double gaps_per_second();
+
+    /**
+     * returns the average prime gaps per second of all workers
+     */
+    double avg_gaps_per_second();
+
+    /**
+     * returns the prime tests per second of all workers
+     */
+    double tests_per_second();
+
+    /**
+     * returns the average prime tests per second of all workers
+     */
+    double avg_tests_per_second();
+
+    /**
+     * return the total number of found primes of all workers
+     */
+    uint64_t get_found_primes();
+
+    /**
+     * returns the windows per second the sieve stage
+     * (the scan stage) finished since the last start
+     */
+    double sieve_windows_per_sec();
+    double scan_windows_per_sec();
+
+    /**
+     * returns the fraction of time the threads of the sieve stage
+     * (the scan stage) were busy since the last start, the rest they
+     * waited for the queue
+     */
+    double sieve_stage_load();
+    double scan_stage_load();
+
+    /**
+     * returns the number of windows the given worker sieved 
+     * from its own range
+     */
+    uint64_t get_owned_windows(uint32_t worker);
+
+    /**
+     * returns the number of windows the given worker sieved 
+     * from ranges stolen from other workers
+     */
+    uint64_t get_stolen_windows(uint32_t worker);
+
+    /**
+     * passes a found PoW of a worker to the PoWProcessor
+     * (serialized between the workers), all workers stop
+     * if it returns true (found PoWs of stopped workers are dropped)
+     */
+    bool process(PoW *pow);
+
+    /**
+     * runs the given worker (depending on the mode and its stage)
+     */
+    void run_worker(mining_worker_t *worker);
+
+  private :
+
+    /* number of worker threads */
+    uint32_t n_threads;
+
+    /* the workers */
+    mining_worker_t *workers;
+
+    /* callback object to process an calculated PoW */
+    PoWProcessor *pprocessor;
+
+    /* serializes the calls of pprocessor */
+    pthread_mutex_t mutex;
+
+    /**
+     * whether the workers should stop 
+     * (set under queue_mutex, polled by the workers without it)
+     */
+    std::atomic<bool> stopped;
+
+    /**
+     * number of workers sieving windows (the first ones), 
+     * all in the plain mode
+     */
+    uint32_t n_sieve_threads;
+
+    /* whether the sieve and scan stages run in different workers */
+    bool pipelined;
+
+    /* number of windows of the pipeline queue */
+    uint32_t queue_size;
+
+    /* the window buffers of the pipeline queue */
+    sieve_window_t *queue_windows;
+
+    /* the unused window buffers */
+    sieve_window_t **free_windows;
+    uint32_t n_free;
+
+    /* the sieved windows waiting for a scan (ring buffer) */
+    sieve_window_t **full_windows;
+    uint32_t full_first, n_full;
+
+    /* number of sieve stage workers still running */
+    uint32_t active_sieve_threads;
+
+    /* guards the queue */
+    pthread_mutex_t queue_mutex;
+
+    /* signals a sieved (a freed) window */
+    pthread_cond_t queue_filled, queue_freed;
+
+    /* the time (usec) of the last start and of its finish (0 if running) */
+    uint64_t start_time, end_time;
+
+    /**
+     * sieves and scans windows (plain mode)
+     */
+    void run_plain(mining_worker_t *worker);
+
+    /**
+     * sieves windows and queues them (pipelined mode)
+     */
+    void run_sieve_stage(mining_worker_t *worker);
+
+    /**
+     * scans queued windows (pipelined mode)
+     */
+    void run_scan_stage(mining_worker_t *worker);
+
+    /**
+     * sets stopped and wakes up all workers waiting for the queue
+     */
+    void stop_workers();
+
+    /**
+     * returns the time (usec) passed since the last start
+     */
+    uint64_t passed_time();
+
+    /**
+     * takes the next window of the given worker, or steals some 
+     * if its deque is empty. returns false if there are no windows left
+     */
+    bool next_window(mining_worker_t *worker, uint64_t *window, bool *stolen);
+
+    /**
+     * moves the back half of the fullest deque (of the sieve stage)
+     * to the given (empty) one, returns false if all deques are empty
+     */
+    bool steal_windows(mining_worker_t *thief);
+};
+
+#endif /* __MINING_ENGINE_H__ */
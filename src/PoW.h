@@ -29,6 +29,7 @@
 #include <vector>
 #include <string>
 #include "PoWUtils.h"
+#include "Verifier.h"
 
 /**
  * Compile time opt-out protection
@@ -105,14 +106,30 @@ class PoW {
     /*****************************/
  
     void     get_hash(mpz_t mpz_hash);
+    void     set_hash(mpz_t mpz_hash);
+    void     set_hash(const vector<uint8_t> *hash);
     uint16_t get_shift();
     uint32_t get_nonce();
+    void     set_nonce(uint32_t nonce);
     void     set_shift(uint16_t shift);
     void     get_adder(mpz_t mpz_adder);
     void     get_adder(vector<uint8_t> *adder);
     void     set_adder(mpz_t mpz_adder);
-    void     set_adder(vector<uint8_t> *adder);
+    void     set_adder(const vector<uint8_t> *adder);
     uint64_t get_target();
+    void     set_target(uint64_t difficulty);
+
+    /**
+     * sets the probable prime test of the validation 
+     * (VERIFIER_PRIME_TEST by default)
+     */
+    void     set_prime_test(prime_test_t test);
+
+    /**
+     * sets the number of threads validating this PoW (one by default,
+     * one per online cpu if n_threads is 0), see Verifier
+     */
+    void     set_threads(uint32_t n_threads);
 
   private :
     
@@ -134,11 +151,50 @@ class PoW {
     /* PoW calculation utils */
     PoWUtils *utils;
 
+    /* the prime search of the gap end */
+    Verifier *verifier;
+
+    /**
+     * the start and end prime and the values derived from them are 
+     * calculated once and cached till the shift or adder changes
+     */
+    
+    /* whether the end points were calculated */
+    bool has_end_points;
+
+    /* whether the end points were calculated correctly */
+    bool end_points_valid;
+
+    /* whether the difficulty / merit were calculated */
+    bool has_difficulty, has_merit;
+
+    /* the cached start and end prime */
+    mpz_t mpz_gap_start, mpz_gap_end;
+
+    /* the cached derived values */
+    uint64_t cached_difficulty, cached_merit, cached_gap_len;
+
+    /**
+     * calculates the start of this pow,
+     * returns whether the pow parameters are valid
+     */
+    bool get_start();
+
     /**
-     * calculates the start and end prime for this pow.
+     * caches the end points after the end prime was found
+     */
+    void set_end_points();
+
+    /**
+     * calculates the start and end prime for this pow (if not cached).
      * returns whether the start and end were calculated correctly
      */
-    bool get_end_points(mpz_t mpz_start, mpz_t mpz_end);
+    bool get_end_points();
+
+    /**
+     * drops the cached end points and values
+     */
+    void reset_end_points();
 
 };
 
@@ -0,0 +1,188 @@
+/**
+ * Implementation of a multi-threaded batch verifier for Gapcoins PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <inttypes.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gmp.h>
+#include <algorithm>
+
+#include "PoWBatchVerifier.h"
+
+/**
+ * thread entry point of a worker
+ */
+static void *batch_worker_main(void *args) {
+
+  batch_worker_t *worker = (batch_worker_t *) args;
+  worker->verifier->run_worker(worker);
+
+  return NULL;
+}
+
+/**
+ * orders the entry indices by decreasing expected validation cost:
+ * the size of the start (shift) dominates the cost of each prime test,
+ * the target the length of the searched gap
+ */
+class batch_cost_order {
+
+  public :
+
+    batch_cost_order(const vector<pow_batch_entry_t> *pows) : pows(pows) { }
+
+    bool operator()(uint32_t a, uint32_t b) const {
+
+      const pow_batch_entry_t *x = &(*pows)[a];
+      const pow_batch_entry_t *y = &(*pows)[b];
+
+      if (x->shift != y->shift)
+        return x->shift > y->shift;
+
+      return x->difficulty > y->difficulty;
+    }
+
+  private :
+
+    const vector<pow_batch_entry_t> *pows;
+};
+
+/**
+ * create a new PoWBatchVerifier
+ */
+PoWBatchVerifier::PoWBatchVerifier(uint32_t n_threads) {
+
+  if (n_threads == 0) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n_threads   = (n_cpus > 0) ? n_cpus : 1;
+  }
+
+  this->n_threads = n_threads;
+  this->pows      = NULL;
+  this->next      = 0;
+  this->workers   = (batch_worker_t *) malloc(sizeof(batch_worker_t) *
+                                              n_threads);
+  pthread_mutex_init(&mutex, NULL);
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+    workers[i].verifier = this;
+    workers[i].pow      = new PoW((const vector<uint8_t> *) NULL,
+                                  0,
+                                  NULL,
+                                  0);
+    workers[i].running  = false;
+  }
+}
+
+PoWBatchVerifier::~PoWBatchVerifier() {
+
+  for (uint32_t i = 0; i < n_threads; i++)
+    delete workers[i].pow;
+
+  free(workers);
+  pthread_mutex_destroy(&mutex);
+}
+
+/**
+ * validates all given PoWs
+ */
+void PoWBatchVerifier::verify(const vector<pow_batch_entry_t> *pows,
+                              vector<bool> *results) {
+
+  const uint32_t n = pows->size();
+
+  this->pows = pows;
+  this->next = 0;
+  valid.assign(n, 0);
+  order.resize(n);
+
+  for (uint32_t i = 0; i < n; i++)
+    order[i] = i;
+
+  stable_sort(order.begin(), order.end(), batch_cost_order(pows));
+
+  /* no more threads than entries, the calling one is the first worker */
+  uint32_t n_workers = (n < n_threads) ? n : n_threads;
+
+  for (uint32_t i = 1; i < n_workers; i++) {
+    workers[i].running = (pthread_create(&workers[i].thread,
+                                         NULL,
+                                         batch_worker_main,
+                                         workers + i) == 0);
+  }
+
+  if (n > 0)
+    run_worker(workers);
+
+  for (uint32_t i = 1; i < n_workers; i++) {
+    if (workers[i].running) {
+      pthread_join(workers[i].thread, NULL);
+      workers[i].running = false;
+    }
+  }
+
+  results->assign(n, false);
+  for (uint32_t i = 0; i < n; i++)
+    (*results)[i] = valid[i];
+
+  this->pows = NULL;
+}
+
+/**
+ * returns the number of worker threads
+ */
+uint32_t PoWBatchVerifier::get_n_threads() {
+  return n_threads;
+}
+
+/**
+ * returns the index of the next entry to validate
+ */
+uint32_t PoWBatchVerifier::next_entry() {
+
+  uint32_t entry = pows->size();
+
+  pthread_mutex_lock(&mutex);
+  if (next < order.size())
+    entry = order[next++];
+  pthread_mutex_unlock(&mutex);
+
+  return entry;
+}
+
+/**
+ * validates entries till the batch is empty
+ */
+void PoWBatchVerifier::run_worker(batch_worker_t *worker) {
+
+  PoW *pow = worker->pow;
+
+  for (uint32_t i = next_entry(); i < pows->size(); i = next_entry()) {
+
+    const pow_batch_entry_t *entry = &(*pows)[i];
+
+    pow->set_hash(&entry->hash);
+    pow->set_shift(entry->shift);
+    pow->set_adder(&entry->adder);
+    pow->set_target(entry->difficulty);
+    pow->set_nonce(entry->nonce);
+
+    valid[i] = pow->valid();
+  }
+}
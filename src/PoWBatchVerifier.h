@@ -0,0 +1,131 @@
+/**
+ * Header file of a multi-threaded batch verifier for Gapcoins PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __POW_BATCH_VERIFIER_H__
+#define __POW_BATCH_VERIFIER_H__
+#include <inttypes.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <vector>
+
+#include "PoW.h"
+
+using namespace std;
+
+class PoWBatchVerifier;
+
+/**
+ * a PoW of the batch in block header format
+ */
+typedef struct {
+  vector<uint8_t> hash;
+  uint16_t shift;
+  vector<uint8_t> adder;
+  uint64_t difficulty;
+  uint32_t nonce;
+} pow_batch_entry_t;
+
+/**
+ * the state of one verifier thread
+ */
+typedef struct {
+
+  /* the batch verifier this worker belongs to */
+  PoWBatchVerifier *verifier;
+
+  /**
+   * the PoW this worker validates the entries with,
+   * reused so its PoWUtils and GMP scratch space stay allocated
+   */
+  PoW *pow;
+
+  /* whether the thread was started and has to be joined */
+  bool running;
+
+  pthread_t thread;
+} batch_worker_t;
+
+/**
+ * Validates many PoWs at once (e.g. all blocks of a sync),
+ * spread over n worker threads
+ */
+class PoWBatchVerifier {
+
+  public :
+
+    /**
+     * create a new PoWBatchVerifier with n_threads workers
+     * (one per online cpu if n_threads is 0)
+     */
+    PoWBatchVerifier(uint32_t n_threads = 0);
+
+    ~PoWBatchVerifier();
+
+    /**
+     * validates all given PoWs, results[i] is set to pows[i].valid().
+     *
+     * The entries are taken most expensive first (by shift, then
+     * by target), so the threads do not wait for a single large one
+     * at the end of the batch.
+     */
+    void verify(const vector<pow_batch_entry_t> *pows, vector<bool> *results);
+
+    /**
+     * returns the number of worker threads
+     */
+    uint32_t get_n_threads();
+
+    /**
+     * validates entries till the batch is empty
+     */
+    void run_worker(batch_worker_t *worker);
+
+  private :
+
+    /* number of worker threads */
+    uint32_t n_threads;
+
+    /* the workers */
+    batch_worker_t *workers;
+
+    /* the current batch */
+    const vector<pow_batch_entry_t> *pows;
+
+    /* the entry indices of the current batch, most expensive first */
+    vector<uint32_t> order;
+
+    /**
+     * the results of the current batch (one byte per entry,
+     * as threads can not write the bits of a vector<bool> concurrently)
+     */
+    vector<uint8_t> valid;
+
+    /* position of the next entry in order */
+    uint32_t next;
+
+    /* guards next */
+    pthread_mutex_t mutex;
+
+    /**
+     * returns the index of the next entry to validate,
+     * or pows->size() if there is none left
+     */
+    uint32_t next_entry();
+};
+
+#endif /* __POW_BATCH_VERIFIER_H__ */
@@ -36,6 +36,132 @@ using namespace std;
 /* return |x| */
 #define abs(x) (((x) < 0) ? (x) * -1 : x)
 
+/**
+ * the fixed point log2 (a 64 bit build with 128 bit integers)
+ */
+#if defined(__SIZEOF_INT128__) && GMP_NUMB_BITS == 64 && __WORDSIZE == 64
+#define FAST_LOG2
+
+typedef unsigned __int128 uint128_t;
+
+/* fractional bits of the fixed point numbers (values < 4) */
+#define FIXED_BITS 126
+
+/* 2 as fixed point number */
+#define FIXED_TWO (((uint128_t) 1) << (FIXED_BITS + 1))
+
+/**
+ * returns the 128 bits of mpz starting at bit index
+ */
+static inline uint128_t mpz_get_bits128(mpz_t mpz, mp_bitcnt_t index) {
+
+  const mp_size_t   n   = index / 64;
+  const mp_bitcnt_t off = index % 64;
+
+  const mp_limb_t l0 = mpz_getlimbn(mpz, n);
+  const mp_limb_t l1 = mpz_getlimbn(mpz, n + 1);
+  const mp_limb_t l2 = mpz_getlimbn(mpz, n + 2);
+
+  if (off == 0)
+    return (((uint128_t) l1) << 64) | l0;
+
+  return (((uint128_t) ((l1 >> off) | (l2 << (64 - off)))) << 64) | 
+         ((l0 >> off) | (l1 << (64 - off)));
+}
+
+/**
+ * returns the fixed point square of x < 2, 
+ * rounded up if round_up is set, else down
+ */
+static inline uint128_t fixed_square(uint128_t x, bool round_up) {
+
+  const uint64_t x0 = (uint64_t) x;
+  const uint64_t x1 = (uint64_t) (x >> 64);
+
+  const uint128_t p00 = (uint128_t) x0 * x0;
+  const uint128_t p01 = (uint128_t) x0 * x1;
+  const uint128_t p11 = (uint128_t) x1 * x1;
+
+  /* x^2 = hi * 2^128 + lo */
+  const uint128_t mid = (p00 >> 64) + 2 * (uint128_t) (uint64_t) p01;
+  const uint128_t lo  = (mid << 64) | (uint64_t) p00;
+  const uint128_t hi  = p11 + 2 * (p01 >> 64) + (mid >> 64);
+
+  const uint128_t square = (hi << (128 - FIXED_BITS)) | (lo >> FIXED_BITS);
+  const uint128_t rest   = lo & ((((uint128_t) 1) << FIXED_BITS) - 1);
+
+  return (round_up && rest != 0) ? square + 1 : square;
+}
+
+/**
+ * mpz_log2 from the top 127 bits of mpz_src, for accuracy <= 64 and
+ * accuracy + log2(src) >= FIXED_BITS.
+ *
+ * mpz_log2 squares n = src / 2^log2(src) with accuracy + log2(src) 
+ * fractional bits, rounded down. Here the interval [lo, hi] with
+ * FIXED_BITS fractional bits follows n: it is rounded outwards, and 
+ * one unit of the fixed point numbers covers the rounding of n. So both 
+ * take the same steps as long as each n < 2 decision is the same for lo 
+ * and hi. returns false (mpz_log is not set) as soon as they differ.
+ */
+static bool fast_log2(mpz_t mpz_log, mpz_t mpz_src, uint32_t accuracy) {
+
+  const uint64_t int_log = mpz_sizeinbase(mpz_src, 2) - 1;
+
+  if (mpz_sgn(mpz_src) <= 0 || 
+      accuracy > 64 || 
+      accuracy + int_log < FIXED_BITS)
+    return false;
+
+  uint128_t lo, hi;
+
+  if (int_log >= FIXED_BITS) {
+    lo = mpz_get_bits128(mpz_src, int_log - FIXED_BITS);
+    hi = lo + (mpz_scan1(mpz_src, 0) < int_log - FIXED_BITS);
+  } else {
+    lo = mpz_get_bits128(mpz_src, 0) << (FIXED_BITS - int_log);
+    hi = lo;
+  }
+
+  uint64_t frac = 0;
+  uint32_t bits = 0;
+
+  for (;;) {
+
+    /* while n < 2 */
+    while (bits <= accuracy) {
+
+      if (lo >= FIXED_TWO)
+        break;
+
+      if (hi >= FIXED_TWO)
+        return false;
+
+      /* n = n^2 */
+      lo = fixed_square(lo, false) - 1;
+      hi = fixed_square(hi, true);
+
+      bits++;
+    }
+
+    if (bits > accuracy) break;
+
+    /* log += 2^(accuracy - bits) */
+    frac |= ((uint64_t) 1) << (accuracy - bits);
+
+    /* n = n / 2 */
+    lo = (lo >> 1) - 1;
+    hi = (hi >> 1) + (hi & 1);
+  }
+
+  mpz_set_ui64(mpz_log, int_log);
+  mpz_mul_2exp(mpz_log, mpz_log, accuracy);
+  mpz_add_ui(mpz_log, mpz_log, frac);
+
+  return true;
+}
+#endif
+
 /**
  * calculates the log2 from a mpz value,
  * the return value is 2^accuracy times grater than
@@ -43,6 +169,11 @@ using namespace std;
  */
 void PoWUtils::mpz_log2(mpz_t mpz_log, mpz_t mpz_src, uint32_t accuracy) {
 
+#ifdef FAST_LOG2
+  if (fast_log2(mpz_log, mpz_src, accuracy))
+    return;
+#endif
+
   mpz_t mpz_tmp, mpz_n;
   mpz_init(mpz_tmp);
   mpz_init_set(mpz_n, mpz_src);
@@ -403,6 +534,57 @@ uint64_t PoWUtils::target_size(mpz_t mpz_start, uint64_t difficulty) {
 }
 
 
+/**
+ * returns the minimal gap size a gap with the given start needs 
+ * to reach the given difficulty with the greatest random part
+ *
+ * difficulty() = merit + rand % min_gap_distance_merit, so a gap needs 
+ * merit >= difficulty - (min_gap_distance_merit - 1), where 
+ * merit = (size * log2(e) * 2^(64 + 48)) / (log2(start) * 2^64) 
+ * grows with the size
+ */
+uint64_t PoWUtils::min_gap_size(mpz_t mpz_start, uint64_t difficulty) {
+
+  mpz_t mpz_ld, mpz_tmp;
+  mpz_init(mpz_ld);
+  mpz_init(mpz_tmp);
+
+  /* min_gap_distance_merit as in difficulty() */
+  mpz_set_ui64(mpz_tmp, 2);
+  mpz_mul(mpz_tmp, mpz_tmp, mpz_log2e112);
+
+  mpz_log2(mpz_ld, mpz_start, 64);
+  mpz_div(mpz_tmp, mpz_tmp, mpz_ld);
+
+  uint64_t min_gap_distance_merit = 1;
+  if (mpz_fits_uint64_p(mpz_tmp))
+    min_gap_distance_merit = mpz_get_ui64(mpz_tmp);
+
+  uint64_t max_rand = 0;
+  if (min_gap_distance_merit > 0)
+    max_rand = min_gap_distance_merit - 1;
+
+  uint64_t min_size = 0;
+
+  if (difficulty > max_rand) {
+
+    /* min_size = ceil((difficulty - max_rand) * log2(start) / log2(e)) */
+    mpz_set_ui64(mpz_tmp, difficulty - max_rand);
+    mpz_mul(mpz_tmp, mpz_tmp, mpz_ld);
+    mpz_cdiv_q(mpz_tmp, mpz_tmp, mpz_log2e112);
+
+    min_size = UINT64_MAX;
+    if (mpz_fits_uint64_p(mpz_tmp))
+      min_size = mpz_get_ui64(mpz_tmp);
+  }
+
+  mpz_clear(mpz_ld);
+  mpz_clear(mpz_tmp);
+
+  return min_size;
+}
+
+
 /**
  * returns the estimated work required to find 
  * a gap with the given difficulty, which is e^difficulty
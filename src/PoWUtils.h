@@ -240,6 +240,13 @@ class PoWUtils {
      */
     uint64_t target_size(mpz_t mpz_start, uint64_t difficulty);
 
+    /**
+     * returns the minimal gap size a gap with the given start needs 
+     * to reach the given difficulty with the greatest random part, 
+     * smaller gaps can not reach it
+     */
+    uint64_t min_gap_size(mpz_t mpz_start, uint64_t difficulty);
+
     /**
      * returns the estimated work required to find 
      * a gap with the given difficulty, which is e^difficulty
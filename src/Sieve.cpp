@@ -31,16 +31,156 @@
 
 #include "Sieve.h"
 
+#ifdef ISA_DISPATCH
+#include <immintrin.h>
+#endif
+
 using namespace std;
 
+/**
+ * the presieve primes
+ */
+static const sieve_t presieve_primes[PRESIEVE_PRIMES] = {
+  3, 5, 7, 11, 13, 17, 19, 23, 29, 31
+};
+
+/**
+ * the end of each presieve group within presieve_primes,
+ * chosen so that all patterns together fit into the L1 cache
+ */
+static const sieve_t presieve_group_ends[PRESIEVE_GROUPS] = { 4, 6, 8, 10 };
+
+/**
+ * the residues mod 30 stored in one wheel byte
+ */
+static const sieve_t wheel30[8] = { 1, 7, 11, 13, 17, 19, 23, 29 };
+
+/**
+ * the wheel byte bit of each residue mod 30 (0xff: divisible by 2, 3 or 5)
+ */
+static const uint8_t wheel30_bit[30] = {
+  0xff,    0, 0xff, 0xff, 0xff, 0xff, 0xff,    1, 0xff, 0xff, 
+  0xff,    2, 0xff,    3, 0xff, 0xff, 0xff,    4, 0xff,    5, 
+  0xff, 0xff, 0xff,    6, 0xff, 0xff, 0xff, 0xff, 0xff,    7
+};
+
+/**
+ * the first wheel byte bit of a residue >= r mod 30 (8: none)
+ */
+static const uint8_t wheel30_next[30] = {
+  0, 0, 1, 1, 1, 1, 1, 1, 2, 2,
+  2, 2, 3, 3, 4, 4, 4, 4, 5, 5,
+  6, 6, 6, 6, 7, 7, 7, 7, 7, 7
+};
+
+/**
+ * the last wheel byte bit of a residue <= r mod 30 (8: none)
+ */
+static const uint8_t wheel30_prev[30] = {
+  8, 0, 0, 0, 0, 0, 0, 1, 1, 1,
+  1, 2, 2, 3, 3, 3, 3, 4, 4, 5,
+  5, 5, 5, 6, 6, 6, 6, 6, 6, 7
+};
+
+/**
+ * returns a * b mod m
+ */
+static inline sieve_t mulmod(sieve_t a, sieve_t b, sieve_t m) {
+
+#if __WORDSIZE == 64
+  if (m > UINT32_MAX)
+    return (sieve_t) (((unsigned __int128) a * b) % m);
+#endif
+
+  return (sieve_t) (((uint64_t) a * b) % m);
+}
+
+/**
+ * returns a^-1 mod m (a and m have to be coprime)
+ */
+static sieve_t inverse_mod(sieve_t a, sieve_t m) {
+
+  ssieve_t t = 0, new_t = 1, tmp;
+  ssieve_t r = m, new_r = a % m;
+
+  while (new_r != 0) {
+    ssieve_t q = r / new_r;
+
+    tmp = t - q * new_t; t = new_t; new_t = tmp;
+    tmp = r - q * new_r; r = new_r; new_r = tmp;
+  }
+
+  return (t < 0) ? t + m : t;
+}
+
+/**
+ * the statistics of a Sieve are only written by the thread scanning
+ * its windows, but read by others, so relaxed loads and stores suffice
+ */
+static inline uint64_t stat_get(const std::atomic<uint64_t> *counter) {
+  return counter->load(std::memory_order_relaxed);
+}
+
+/**
+ * adds x to the given statistic
+ */
+static inline void stat_add(std::atomic<uint64_t> *counter, uint64_t x) {
+  counter->store(stat_get(counter) + x, std::memory_order_relaxed);
+}
+
+/**
+ * moves the given moving average three quarters towards x
+ */
+static inline void stat_average(std::atomic<uint64_t> *counter, double x) {
+  counter->store((stat_get(counter) + 3 * x) / 4, std::memory_order_relaxed);
+}
+
 /**
  * create a new Sieve
  */
-Sieve::Sieve(PoWProcessor *pprocessor, uint64_t n_primes, uint64_t sievesize) {
+Sieve::Sieve(PoWProcessor *pprocessor, 
+             uint64_t n_primes, 
+             uint64_t sievesize,
+             sieve_layout_t layout) {
+
+  /* bucket entries store the primes in 32 bits */
+  if (n_primes > MAX_SIEVE_PRIMES)
+    n_primes = MAX_SIEVE_PRIMES;
+
+  if (layout == SIEVE_WHEEL30) {
+
+    /* one word of wheel bytes per word bits * 30 numbers, 
+     * plus one word for the offset of start to a multiple of 30 */
+    this->sievesize      = bound(sievesize, sizeof(sieve_t) * 8 * 30);
+    this->window_bits    = this->sievesize * 8 / 30;
+    this->sieve_bits     = this->window_bits + sizeof(sieve_t) * 8;
+    this->prog_shift     = 3;
+  } else {
+    this->sievesize      = bound(sievesize, sizeof(sieve_t) * 16);
+    this->sieve_bits     = this->sievesize / 2;
+    this->window_bits    = this->sieve_bits;
+    this->prog_shift     = 0;
+  }
 
   this->pprocessor       = pprocessor;
-  this->sievesize        = bound(sievesize, sizeof(sieve_t) * 8);
+  this->layout           = layout;
+  this->wheel_inv        = NULL;
+  this->wheel_delta      = 0;
   this->n_primes         = n_primes;
+  this->segment_size     = 0;
+  this->segment_shift    = 0;
+  this->bucket_start     = n_primes;
+  this->n_buckets        = 0;
+  this->buckets          = NULL;
+  this->overflow         = NULL;
+  this->free_blocks      = NULL;
+  this->window_done      = false;
+  this->hash_mods        = NULL;
+  this->cur_pow2_mods    = NULL;
+  this->isa              = isa_detect();
+  this->mont_end         = 0;
+  this->mont_ninv        = NULL;
+  this->mont_r2          = NULL;
   this->found_primes     = 0;
   this->n_gaps           = 0;
   this->cur_n_gaps       = 0;
@@ -49,16 +189,25 @@ Sieve::Sieve(PoWProcessor *pprocessor, uint64_t n_primes, uint64_t sievesize) {
   this->passed_time      = 1;
   this->cur_found_primes = 0;
   this->cur_passed_time  = 1;
-  this->sieve            = (sieve_t *) malloc(this->sievesize / 8);
+  this->sieve            = (sieve_t *) malloc(this->sieve_bits / 8);
   this->primes           = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
-  this->primes2          = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
-  this->starts           = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
+  this->starts           = (sieve_t *) malloc(sizeof(sieve_t) * 
+                                          (n_primes << prog_shift));
   this->utils            = new PoWUtils();
+  this->fermat           = new Fermat(isa);
+  this->scan_cursors     = (fermat->get_lanes() > 1) ? 
+                           4 * fermat->get_lanes() : 1;
   mpz_init(this->mpz_start);
-  mpz_init(this->mpz_e);
-  mpz_init(this->mpz_r);
-  mpz_init_set_ui64(this->mpz_two, 2);
+  mpz_init(this->mpz_offset);
+  mpz_init(this->mpz_mods_hash);
   init_primes(n_primes);
+  init_mods();
+
+  if (layout == SIEVE_WHEEL30)
+    init_wheel();
+
+  init_presieve();
+  set_segment_size(SIEVE_SEGMENT_SIZE);
 }
 
 
@@ -66,13 +215,38 @@ Sieve::~Sieve() {
   
   free(sieve);
   free(primes);
-  free(primes2);
   free(starts);
+  free(wheel_inv);
+  free(hash_mods);
+  free(mont_ninv);
+  free(mont_r2);
+
+  for (map<uint16_t, sieve_t *>::iterator it = pow2_mods.begin(); 
+       it != pow2_mods.end(); 
+       it++) {
+
+    free(it->second);
+  }
+
+  for (sieve_t i = 0; i < n_buckets; i++)
+    bucket_free(buckets + i);
+
+  bucket_free(&overflow);
+  free(buckets);
+
+  for (sieve_t i = 0; i < PRESIEVE_GROUPS; i++)
+    free(presieve[i]);
+
+  while (free_blocks != NULL) {
+    bucket_block_t *block = free_blocks;
+    free_blocks = block->next;
+    free(block);
+  }
 
   mpz_clear(mpz_start);
-  mpz_clear(mpz_e);
-  mpz_clear(mpz_r);
-  mpz_clear(mpz_two);
+  mpz_clear(mpz_offset);
+  mpz_clear(mpz_mods_hash);
+  delete fermat;
 
   delete utils;
 }
@@ -84,6 +258,59 @@ void Sieve::set_pprocessor(PoWProcessor *pprocessor) {
   this->pprocessor = pprocessor;
 }
 
+/**
+ * precalculates 2^shift mod p of each sieve prime for the given shift
+ */
+void Sieve::init_shift(uint16_t shift) {
+
+  if (pow2_mods.count(shift))
+    return;
+
+  sieve_t *mods = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
+
+  mpz_t mpz_pow2;
+  mpz_init_set_ui64(mpz_pow2, 1);
+  mpz_mul_2exp(mpz_pow2, mpz_pow2, shift);
+
+  calc_mods(mods, mpz_pow2);
+  mpz_clear(mpz_pow2);
+
+  pow2_mods[shift] = mods;
+}
+
+/**
+ * sets the size in bits of the segments the sieve is processed in
+ */
+void Sieve::set_segment_size(uint64_t segment_size) {
+  
+  /* 0 sieves all in one segment */
+  if (segment_size == 0 || segment_size > sieve_bits)
+    segment_size = sieve_bits;
+
+  /**
+   * a power of two avoids divisions when filing bucket entries,
+   * and at most 2^32 bits keep their indexes within 32 bits
+   */
+  for (segment_shift = (sizeof(sieve_t) == 8) ? 6 : 5; 
+       ((sieve_t) 1 << segment_shift) < segment_size && segment_shift < 32;
+       segment_shift++);
+
+  this->segment_size = (sieve_t) 1 << segment_shift;
+  this->window_done  = false;
+
+  /* primes greater than a segment hit each segment at most once */
+  for (bucket_start = PRESIEVE_PRIMES + 1; 
+       bucket_start < n_primes && 
+       (primes[bucket_start] << prog_shift) < this->segment_size;
+       bucket_start++);
+
+  /* the buckets are empty between two runs */
+  n_buckets = (sieve_bits + this->segment_size - 1) >> segment_shift;
+  buckets   = (bucket_block_t **) realloc(buckets, 
+                                          sizeof(bucket_block_t *) * n_buckets);
+  memset(buckets, 0, sizeof(bucket_block_t *) * n_buckets);
+}
+
 /** 
  * sieve for the given header hash 
  *
@@ -96,157 +323,358 @@ void Sieve::set_pprocessor(PoWProcessor *pprocessor) {
  */
 void Sieve::run_sieve(PoW *pow, vector<uint8_t> *offset) {
 
-  /* speed measurement */
-  uint64_t start_time = PoWUtils::gettime_usec();
-  
   mpz_t mpz_offset;
   mpz_init_set_ui64(mpz_offset, 0);
 
   if (offset != NULL)
     ary_to_mpz(mpz_offset, offset->data(), offset->size());
 
+  run_sieve(pow, mpz_offset);
+  mpz_clear(mpz_offset);
+}
+
+/**
+ * sieve the window following the last sieved one 
+ */
+void Sieve::run_sieve_next(PoW *pow) {
+
+  mpz_t mpz_offset;
+  mpz_init_set(mpz_offset, this->mpz_offset);
+  mpz_add_ui(mpz_offset, mpz_offset, sievesize);
+
+  run_sieve(pow, mpz_offset);
+  mpz_clear(mpz_offset);
+}
+
+/**
+ * allocates a window buffer matching this sieve
+ */
+void Sieve::init_window(sieve_window_t *window) {
+
+  window->sieve       = (sieve_t *) malloc(sieve_bits / 8);
+  window->wheel_delta = 0;
+  mpz_init(window->mpz_start);
+  mpz_init(window->mpz_offset);
+}
+
+/**
+ * frees a window buffer
+ */
+void Sieve::clear_window(sieve_window_t *window) {
+
+  free(window->sieve);
+  mpz_clear(window->mpz_start);
+  mpz_clear(window->mpz_offset);
+}
+
+/**
+ * moves the sieved window into the given buffer 
+ * (the sieve continues with the buffers old memory)
+ */
+void Sieve::get_window(sieve_window_t *window) {
+
+  sieve_t *tmp        = window->sieve;
+  window->sieve       = sieve;
+  window->wheel_delta = wheel_delta;
+  sieve               = tmp;
+
+  mpz_set(window->mpz_start, mpz_start);
+  mpz_set(window->mpz_offset, mpz_offset);
+}
+
+/**
+ * makes the sieved window of the given buffer the current one
+ * (the buffer gets the old memory of the sieve)
+ */
+void Sieve::set_window(sieve_window_t *window) {
+
+  sieve_t *tmp  = window->sieve;
+  window->sieve = sieve;
+  sieve         = tmp;
+  wheel_delta   = window->wheel_delta;
+
+  mpz_set(mpz_start, window->mpz_start);
+  mpz_set(mpz_offset, window->mpz_offset);
+
+  /* the prime indexes do not belong to this window */
+  window_done = false;
+}
+
+/** 
+ * sieve for the given header hash at the given offset (mpz version)
+ */
+void Sieve::run_sieve(PoW *pow, mpz_t mpz_offset) {
+
+  /* speed measurement */
+  uint64_t start_time = PoWUtils::gettime_usec();
+
+  sieve_window(pow, mpz_offset);
+  scan_window(pow, start_time);
+}
+
+/**
+ * sieves the window at the given offset for the given header hash
+ */
+void Sieve::sieve_window(PoW *pow, mpz_t mpz_offset) {
+
+  mpz_set(this->mpz_offset, mpz_offset);
+  
   /* make sure offset (and later start) is divisible by two */
   if (mpz_get_ui64(mpz_offset) & 0x1)
-    mpz_add_ui(mpz_offset, mpz_offset, 1L);
+    mpz_add_ui(this->mpz_offset, this->mpz_offset, 1L);
 
-  mpz_t mpz_adder, mpz_tmp;
+  mpz_t mpz_tmp;
   mpz_init(mpz_tmp);
-  mpz_init(mpz_adder);
 
-  pow->get_hash(mpz_start);
-  mpz_mul_2exp(mpz_start, mpz_start, pow->get_shift());
-  mpz_add(mpz_start, mpz_start, mpz_offset);
+  pow->get_hash(mpz_tmp);
+  mpz_mul_2exp(mpz_tmp, mpz_tmp, pow->get_shift());
+  mpz_add(mpz_tmp, mpz_tmp, this->mpz_offset);
 
-  /* clear the sieve */
-  memset(sieve, 0, sievesize / 8);
+  /* does this window continue the last one */
+  bool next_window = window_done;
+  mpz_swap(mpz_tmp, mpz_start);
+  
+  if (next_window) {
+    mpz_sub(mpz_tmp, mpz_start, mpz_tmp);
+    next_window = (mpz_cmp_ui(mpz_tmp, sievesize) == 0);
+  }
 
   /* calculates for each prime, the first index in the sieve
    * which is divisible by that prime */
-  calc_muls();
+  if (next_window)
+    roll_muls();
+  else {
+    calc_residues(pow);
+    calc_muls();
+    fill_buckets();
+  }
 
-  /* sieve all small primes (skip 2) */
-  for (sieve_t i = 4; i < n_primes; i++) {
+  /* sieve segment by segment, so that the crossing off stays in the cache */
+  for (sieve_t seg_start = 0; seg_start < sieve_bits; seg_start += segment_size) {
+    
+    sieve_t seg_end = seg_start + segment_size;
+    if (seg_end > sieve_bits)
+      seg_end = sieve_bits;
 
-    /**
-     * sieve all odd multiplies of the current prime
-     */
-    for (sieve_t p = starts[i]; p < sievesize; p += primes2[i])
-      set_composite(sieve, p);
+    sieve_segment(seg_start, seg_end);
   }
+  window_done = true;
 
-  /* make sure min_len is divisible by two */
-  sieve_t min_len    = pow->target_size(mpz_start) & ~((sieve_t) 1);
-  sieve_t i          = 1;
-  sieve_t start      = sievesize + 4;
-
-  sieve_t offset3 = 3 - mpz_tdiv_ui(mpz_start, 3);
-  sieve_t offset5 = 5 - mpz_tdiv_ui(mpz_start, 5);
-  sieve_t offset7 = 7 - mpz_tdiv_ui(mpz_start, 7);
+  mpz_clear(mpz_tmp);
+}
 
-  // x mod n == 0: no offset, set to 0
-  if (offset3 == 3) offset3 = 0;
-  if (offset5 == 5) offset5 = 0;
-  if (offset7 == 7) offset7 = 0;
+/**
+ * scans the current window for prime gaps
+ *
+ * The window is split into the ranges of scan_cursors independent 
+ * cursors, the next fermat tests of up to Fermat::get_lanes() cursors are 
+ * done at once. A cursor reports the gaps starting within its range: it
+ * searches the first prime of its range and scans from there on (also 
+ * behind its range end) till its current prime leaves the range, which
+ * is where the next cursor starts. Each gap >= min_len is found 
+ * independent of which primes the backward scans jump to, so the 
+ * cursors report the same gaps as a single scan would.
+ */
+void Sieve::scan_window(PoW *pow, uint64_t start_time) {
 
-  /* find the first prime */
-  for (/* declared */; i < sievesize; i += 2) {
-    
-    if (is_prime(sieve, i)) {
-      if((i % 3) == offset3) continue;
-      if((i % 5) == offset5) continue;
-      if((i % 7) == offset7) continue;
+  if (start_time == 0)
+    start_time = PoWUtils::gettime_usec();
 
-      cur_tests++;
-      tests++;
-      mpz_add_ui(mpz_tmp, mpz_start, i);
+  mpz_t mpz_adder;
+  mpz_init(mpz_adder);
 
-      if (fermat_test(mpz_tmp))
-        break;
-    }
+  /* make sure min_len is divisible by two */
+  sieve_t min_len = pow->target_size(mpz_start) & ~((sieve_t) 1);
+
+  scan_cursor_t cursors[SCAN_MAX_CURSORS];
+  for (int k = 0; k < scan_cursors; k++) {
+    scan_cursor_t *c = cursors + k;
+
+    c->end      = (k + 1 < scan_cursors) ? 
+                  (((k + 1) * (sievesize / scan_cursors)) | 1) : sievesize;
+    c->i        = next_candidate((k * (sievesize / scan_cursors)) | 1);
+    c->start    = sievesize + 4;
+    c->reported = sievesize + 4;
+    c->scan_end = 0;
+    c->first    = true;
+    c->done     = (c->i >= c->end);
   }
 
-  start = i;
-  i    += min_len;
-
-  /* scan the sieve in steps of size min_len */
-  bool finished = false;
+  uint64_t n_first = 0;
   uint64_t n_test = 0;
   uint64_t gap_count = 0;
-  while (i < sievesize && !finished) {
-    
-    /* scan the current gap */
-    for (/* declared */; i > start; i -= 2) {
 
-      if (is_prime(sieve, i)) {
-        if((i % 3) == offset3) continue;
-        if((i % 5) == offset5) continue;
-        if((i % 7) == offset7) continue;
+  const int lanes = fermat->get_lanes();
+  uint64_t offsets[FERMAT_MAX_LANES];
+  bool results[FERMAT_MAX_LANES];
+  scan_cursor_t *batch[FERMAT_MAX_LANES];
 
-        n_test++;
-        mpz_add_ui(mpz_tmp, mpz_start, i);
-     
-        if (fermat_test(mpz_tmp)) {
-          start = i;
-          i += min_len + 2;
-          gap_count++;
-
-          if (i >= sievesize) {
-            i = 2;
-            finished = true;
-          }
-        }
+  for (bool stop = false; !stop; ) {
+
+    /* the next tests of the first lanes unfinished cursors */
+    int n = 0;
+    for (int k = 0; k < scan_cursors && n < lanes; k++) {
+      if (!cursors[k].done) {
+        batch[n]   = cursors + k;
+        offsets[n] = cursors[k].i;
+        n++;
       }
     }
 
-    if (!finished) {
-      gap_count++;
-      mpz_set_ui64(mpz_adder, (uint64_t) start);
-      mpz_add(mpz_adder, mpz_adder, mpz_offset);
- 
-      pow->set_adder(mpz_adder);
- 
-      if (pow->valid()) {
-        if (pprocessor->process(pow))
-          i = sievesize;
-      }
+    if (n == 0)
+      break;
+
+    fermat->fermat_test(mpz_start, offsets, results, n);
+
+    for (int j = 0; j < n && !stop; j++) {
 
-      i += min_len << 1;
+      if (batch[j]->first)
+        n_first++;
+      else
+        n_test++;
+
+      stop = scan_cursor(batch[j], results[j], pow, min_len, mpz_adder, &gap_count);
     }
   }
 
-  mpz_clear(mpz_offset);
   mpz_clear(mpz_adder);
-  mpz_clear(mpz_tmp);
-  passed_time     += PoWUtils::gettime_usec() - start_time;
-  cur_passed_time  = (cur_passed_time + 3 * (PoWUtils::gettime_usec() - start_time)) / 4;
 
-  tests += n_test;
-  cur_tests = (cur_tests + 3 * n_test) / 4;
+  const uint64_t time = PoWUtils::gettime_usec() - start_time;
+  stat_add(&passed_time, time);
+  stat_average(&cur_passed_time, time);
+
+  /* the first test of each cursor counts fully into cur_tests */
+  stat_add(&tests, n_first + n_test);
+  stat_add(&cur_tests, n_first);
+  stat_average(&cur_tests, n_test);
 
-  n_gaps += gap_count;
-  cur_n_gaps = (cur_n_gaps + 3 * gap_count) / 4;
+  stat_add(&n_gaps, gap_count);
+  stat_average(&cur_n_gaps, gap_count);
 
-  /* approximate the number of primes within the sieve */
-  double log_start = log(mpz_get_d(mpz_start));
-  cur_found_primes = (cur_found_primes + 3 * (sievesize / log_start)) / 4;
-  found_primes += sievesize / log_start;
+  /**
+   * approximate the number of primes within the sieve 
+   * (start = d * 2^exp, mpz_get_d would overflow for starts >= 2^1024)
+   */
+  long exp;
+  double log_start = log(mpz_get_d_2exp(&exp, mpz_start)) + exp * M_LN2;
+  stat_average(&cur_found_primes, sievesize / log_start);
+  stat_add(&found_primes, sievesize / log_start);
 
-  if (debug && is_sieve_valid(i))
+  if (debug && is_sieve_valid(sievesize))
     printf("[DD] sieve check [PASSED]\n");
   else if (debug)
     printf("[EE] sieve check [FAILED]\n");
 }
 
+/**
+ * advances the gap scan cursor c by the fermat test result of c->i
+ * to the next offset it has to test
+ */
+inline bool Sieve::scan_cursor(scan_cursor_t *c, 
+                               bool prime, 
+                               PoW *pow, 
+                               sieve_t min_len, 
+                               mpz_t mpz_adder,
+                               uint64_t *gap_count) {
+
+  /* c->i is the end of the next gap to scan (instead of a candidate) */
+  bool next_gap;
+
+  if (c->first) {
+    
+    /* find the first prime */
+    if (!prime) {
+      c->i    = next_candidate(c->i + 2);
+      c->done = (c->i >= c->end);
+      return false;
+    }
+
+    c->first  = false;
+    c->start  = c->i;
+    c->i     += min_len;
+    next_gap  = true;
+  } else {
+
+    /* scan the current gap (backwards) */
+    if (prime) {
+      c->start  = c->i;
+      c->i     += min_len + 2;
+      (*gap_count)++;
+
+      if (c->i >= sievesize || c->start >= c->end) {
+        c->done = true;
+        return false;
+      }
+    }
+
+    c->i     = prev_candidate(c->i - 2);
+    next_gap = false;
+  }
+
+  /* scan the sieve in steps of size min_len */
+  for (;;) {
+
+    if (next_gap) {
+      if (c->i >= sievesize) {
+        c->done = true;
+        return false;
+      }
+
+      c->i = prev_candidate(c->i);
+    }
+
+    /**
+     * the backward scan ends at the gap start, or behind a reported 
+     * gap at the previous scan end (the offsets below are composite)
+     */
+    const sieve_t scanned = (c->start == c->reported) ? 
+                            c->scan_end - min_len : c->start;
+
+    if (c->i > scanned)
+      return false;
+
+    if (c->start != c->reported) {
+      (*gap_count)++;
+      mpz_set_ui64(mpz_adder, (uint64_t) c->start);
+      mpz_add(mpz_adder, mpz_adder, this->mpz_offset);
+ 
+      pow->set_adder(mpz_adder);
+ 
+      if (pow->valid()) {
+        if (pprocessor->process(pow)) {
+          c->done = true;
+          return true;
+        }
+      }
+
+      c->reported  = c->start;
+      c->i        += min_len << 1;
+      c->scan_end  = c->i;
+    } else {
+
+      /**
+       * no prime till the last scan end: the gap is at least 
+       * 2 * min_len + 2 long. Continue behind the scan end (the baseline 
+       * scan reported the same gap start again here, forever)
+       */
+      c->i        = c->scan_end + min_len;
+      c->scan_end = c->i;
+    }
+
+    next_gap = true;
+  }
+}
+
 /**
  * returns the average primes per seconds
  */
 double Sieve::avg_primes_per_sec() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double) found_primes) * 1000000.0L) / 
-         ((double) passed_time);
+  return (((double) stat_get(&found_primes)) * 1000000.0L) / 
+         ((double) stat_get(&passed_time));
 }
 
 /**
@@ -254,11 +682,11 @@ double Sieve::avg_primes_per_sec() {
  */
 double Sieve::primes_per_sec() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double) cur_found_primes) * 1000000.0L) / 
-         ((double) cur_passed_time);
+  return (((double) stat_get(&cur_found_primes)) * 1000000.0L) / 
+         ((double) stat_get(&cur_passed_time));
 }
 
 
@@ -266,7 +694,21 @@ double Sieve::primes_per_sec() {
  * return the total number of found primes
  */
 uint64_t Sieve::get_found_primes() {
-  return found_primes;
+  return stat_get(&found_primes);
+}
+
+/**
+ * returns the number of offsets covered by one window
+ */
+uint64_t Sieve::get_sievesize() {
+  return sievesize;
+}
+
+/**
+ * returns the instruction set of the sieve and fermat kernels
+ */
+isa_t Sieve::get_isa() {
+  return isa;
 }
 
 /**
@@ -274,11 +716,11 @@ uint64_t Sieve::get_found_primes() {
  */
 double Sieve::gaps_per_second() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double)  cur_n_gaps) * 1000000.0L) / 
-         ((double) cur_passed_time);
+  return (((double) stat_get(&cur_n_gaps)) * 1000000.0L) / 
+         ((double) stat_get(&cur_passed_time));
 }
 
 /**
@@ -286,11 +728,11 @@ double Sieve::gaps_per_second() {
  */
 double Sieve::avg_gaps_per_second() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double)  n_gaps) * 1000000.0L) / 
-         ((double) passed_time);
+  return (((double) stat_get(&n_gaps)) * 1000000.0L) / 
+         ((double) stat_get(&passed_time));
 }
 
 /**
@@ -298,11 +740,11 @@ double Sieve::avg_gaps_per_second() {
  */
 double Sieve::tests_per_second() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double) cur_tests) * 1000000.0L)  / 
-         ((double) cur_passed_time);
+  return (((double) stat_get(&cur_tests)) * 1000000.0L) / 
+         ((double) stat_get(&cur_passed_time));
 }
 
 /**
@@ -310,11 +752,11 @@ double Sieve::tests_per_second() {
  */
 double Sieve::avg_tests_per_second() {
 
-  if (passed_time < 10)
+  if (stat_get(&passed_time) < 10)
     return 0;
 
-  return (((double)  tests) * 1000000.0L) / 
-         ((double) passed_time);
+  return (((double) stat_get(&tests)) * 1000000.0L) / 
+         ((double) stat_get(&passed_time));
 }
 
 
@@ -337,7 +779,6 @@ void Sieve::init_primes(uint64_t n) {
   set_bit(sieve, 1);
 
   primes[0]  = 2;
-  primes2[0] = 2 << 1;
 
   /**
    * run the sieve (skip all even numbers)
@@ -352,7 +793,6 @@ void Sieve::init_primes(uint64_t n) {
     
     if (is_prime(sieve, i)) {
       this->primes[p]  = i;
-      this->primes2[p] = i << 1;
       p++;
     }
   }
@@ -365,6 +805,363 @@ void Sieve::init_primes(uint64_t n) {
     printf("[EE] primes check [FAILED]\n");
 }
 
+/**
+ * calculates 30^-1 mod p for the wheel encoding
+ */
+void Sieve::init_wheel() {
+
+  wheel_inv = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
+
+  /* 2, 3 and 5 are part of the wheel */
+  for (sieve_t i = 0; i < n_primes; i++)
+    wheel_inv[i] = (primes[i] > 5) ? inverse_mod(30, primes[i]) : 0;
+}
+
+/**
+ * Generates the presieve patterns
+ *
+ * Each pattern marks every multiple of the primes of its group
+ * (counted in sieve units from a start divisible by all of them).
+ * A unit is one odd number for SIEVE_ODD and one wheel byte for
+ * SIEVE_WHEEL30. As the product of the group is coprime to the 
+ * units per word, the pattern repeats after product words.
+ */
+void Sieve::init_presieve() {
+
+  const sieve_t word_bits = sizeof(sieve_t) * 8;
+
+  for (sieve_t g = 0, first = 0; g < PRESIEVE_GROUPS; g++) {
+    
+    /* the wheel primes are never part of the wheel encoding */
+    sieve_t size = 1;
+    for (sieve_t j = first; j < presieve_group_ends[g]; j++)
+      if (layout != SIEVE_WHEEL30 || 30 % presieve_primes[j] != 0)
+        size *= presieve_primes[j];
+
+    presieve_size[g] = size;
+    presieve[g]      = (sieve_t *) malloc(sizeof(sieve_t) * size);
+    memset(presieve[g], 0, sizeof(sieve_t) * size);
+
+    if (layout == SIEVE_WHEEL30) {
+      presieve_inv[g] = inverse_mod(sizeof(sieve_t), size);
+
+      for (sieve_t j = first; j < presieve_group_ends[g]; j++)
+        for (sieve_t m = 0; m < size * sizeof(sieve_t); m++)
+          for (sieve_t b = 0; b < 8; b++)
+            if ((30 * m + wheel30[b]) % presieve_primes[j] == 0)
+              set_composite(presieve[g], m * 8 + b);
+
+    } else {
+      presieve_inv[g] = inverse_mod(word_bits, size);
+
+      for (sieve_t j = first; j < presieve_group_ends[g]; j++)
+        for (sieve_t p = 0; p < size * word_bits; p += presieve_primes[j])
+          set_composite(presieve[g], p);
+    }
+
+    first = presieve_group_ends[g];
+  }
+}
+
+/**
+ * stamps the presieve patterns into the words [start, end) of the sieve
+ */
+void Sieve::run_presieve(sieve_t start, sieve_t end) {
+
+  for (sieve_t g = 0; g < PRESIEVE_GROUPS; g++) {
+    
+    const sieve_t *pattern = presieve[g];
+    const sieve_t size     = presieve_size[g];
+    sieve_t j              = (start + presieve_offset[g]) % size;
+
+    /* the first pattern replaces the old sieve content */
+    if (g == 0) {
+      for (sieve_t w = start; w < end; /* inside */) {
+        
+        sieve_t len = size - j;
+        if (len > end - w)
+          len = end - w;
+
+        memcpy(sieve + w, pattern + j, sizeof(sieve_t) * len);
+        w += len;
+        j  = 0;
+      }
+    } else {
+      for (sieve_t w = start; w < end; w++) {
+        
+        sieve[w] |= pattern[j];
+        if (++j == size)
+          j = 0;
+      }
+    }
+  }
+}
+
+/**
+ * calculates the Montgomery constants for calc_mods
+ */
+void Sieve::init_mods() {
+  
+  for (mont_end = 0; mont_end < n_primes && primes[mont_end] < (1UL << 31); mont_end++);
+
+  mont_ninv = (uint32_t *) malloc(sizeof(uint32_t) * mont_end);
+  mont_r2   = (uint32_t *) malloc(sizeof(uint32_t) * mont_end);
+
+  /* skip 2 */
+  for (sieve_t i = 1; i < mont_end; i++) {
+    
+    const uint32_t p = primes[i];
+
+    /* newton iteration for p^-1 mod 2^32 */
+    uint32_t inv = p;
+    for (int j = 0; j < 5; j++)
+      inv *= 2 - p * inv;
+
+    mont_ninv[i] = -inv;
+    mont_r2[i]   = ((UINT64_MAX % p) + 1) % p;
+  }
+}
+
+#ifdef ISA_DISPATCH
+/**
+ * the SIMD kernels are build for each instruction set regardless of 
+ * the compiler flags, calc_mods selects them by the cpu features
+ */
+#define SIEVE_AVX2   __attribute__((target("avx2")))
+#define SIEVE_AVX512 __attribute__((target("avx512f")))
+
+/**
+ * AVX-512 operations as the zero masking intrinsics with all lanes set:
+ * the same instructions, but the plain intrinsics pass an undefined
+ * vector, which gcc 12 warns about (-Wmaybe-uninitialized)
+ */
+#define mm512_mul_epu32(a, b)   _mm512_maskz_mul_epu32((__mmask8) -1, a, b)
+#define mm512_srli_epi64(a, n)  _mm512_maskz_srli_epi64((__mmask8) -1, a, n)
+#define mm512_min_epu64(a, b)   _mm512_maskz_min_epu64((__mmask8) -1, a, b)
+#define mm512_cvtepu32_epi64(a) _mm512_maskz_cvtepu32_epi64((__mmask8) -1, a)
+
+/**
+ * Montgomery reduction t * 2^-32 mod p of 8 lanes
+ * for t < p * 2^32, p < 2^31 and ninv = -p^-1 mod 2^32
+ */
+SIEVE_AVX512 static inline __m512i redc32_avx512(__m512i t, __m512i p, __m512i ninv) {
+
+  __m512i m = mm512_mul_epu32(t, ninv);
+  t = mm512_srli_epi64(_mm512_add_epi64(t, mm512_mul_epu32(m, p)), 32);
+
+  return mm512_min_epu64(t, _mm512_sub_epi64(t, p));
+}
+
+/**
+ * Montgomery reduction t * 2^-32 mod p of 4 lanes
+ * for t < p * 2^32, p < 2^31 and ninv = -p^-1 mod 2^32
+ */
+SIEVE_AVX2 static inline __m256i redc32_avx2(__m256i t, __m256i p, __m256i ninv) {
+
+  __m256i m = _mm256_mul_epu32(t, ninv);
+  t = _mm256_srli_epi64(_mm256_add_epi64(t, _mm256_mul_epu32(m, p)), 32);
+
+  /* t >= p: t -= p */
+  return _mm256_sub_epi64(t, _mm256_andnot_si256(_mm256_cmpgt_epi64(p, t), p));
+}
+
+/**
+ * calculates the mods of the primes [i, mont_end) in blocks of 8 * MONT_VECS
+ * (see calc_mods), returns the index of the first prime left over
+ */
+SIEVE_AVX512 static sieve_t calc_mods_avx512(sieve_t *mods, 
+                                             mpz_t mpz_n,
+                                             const sieve_t *primes,
+                                             const uint32_t *mont_ninv,
+                                             const uint32_t *mont_r2,
+                                             sieve_t i,
+                                             sieve_t mont_end) {
+
+  const uint32_t *chunks = (const uint32_t *) mpz_n->_mp_d;
+  const uint32_t n_chunks = mpz_size(mpz_n) * (sizeof(mp_limb_t) / sizeof(uint32_t));
+
+  for (/* argument */; i + 8 * MONT_VECS <= mont_end; i += 8 * MONT_VECS) {
+
+    __m512i p[MONT_VECS], ninv[MONT_VECS], r2[MONT_VECS], t[MONT_VECS], fix[MONT_VECS];
+
+    for (int j = 0; j < MONT_VECS; j++) {
+      p[j]    = _mm512_loadu_si512((const void *) (primes + i + 8 * j));
+      ninv[j] = mm512_cvtepu32_epi64(
+                _mm256_loadu_si256((const __m256i *) (mont_ninv + i + 8 * j)));
+      r2[j]   = mm512_cvtepu32_epi64(
+                _mm256_loadu_si256((const __m256i *) (mont_r2 + i + 8 * j)));
+      t[j]    = _mm512_setzero_si512();
+      fix[j]  = redc32_avx512(r2[j], p[j], ninv[j]);
+    }
+
+    for (uint32_t k = 0; k < n_chunks; k++) {
+      const __m512i c = _mm512_set1_epi64(chunks[k]);
+
+      for (int j = 0; j < MONT_VECS; j++)
+        t[j] = redc32_avx512(_mm512_add_epi64(t[j], c), p[j], ninv[j]);
+    }
+    
+    /* 2^(32 * (n_chunks + 1)) mod p */
+    for (uint32_t e = n_chunks; e > 0; e >>= 1) {
+      for (int j = 0; j < MONT_VECS; j++) {
+        if (e & 1)
+          fix[j] = redc32_avx512(mm512_mul_epu32(fix[j], r2[j]), p[j], ninv[j]);
+
+        r2[j] = redc32_avx512(mm512_mul_epu32(r2[j], r2[j]), p[j], ninv[j]);
+      }
+    }
+
+    for (int j = 0; j < MONT_VECS; j++)
+      _mm512_storeu_si512((void *) (mods + i + 8 * j), redc32_avx512(mm512_mul_epu32(t[j], fix[j]), p[j], ninv[j]));
+  }
+
+  return i;
+}
+
+/**
+ * calculates the mods of the primes [i, mont_end) in blocks of 4 * MONT_VECS
+ * (see calc_mods), returns the index of the first prime left over
+ */
+SIEVE_AVX2 static sieve_t calc_mods_avx2(sieve_t *mods, 
+                                         mpz_t mpz_n,
+                                         const sieve_t *primes,
+                                         const uint32_t *mont_ninv,
+                                         const uint32_t *mont_r2,
+                                         sieve_t i,
+                                         sieve_t mont_end) {
+
+  const uint32_t *chunks = (const uint32_t *) mpz_n->_mp_d;
+  const uint32_t n_chunks = mpz_size(mpz_n) * (sizeof(mp_limb_t) / sizeof(uint32_t));
+
+  for (/* argument */; i + 4 * MONT_VECS <= mont_end; i += 4 * MONT_VECS) {
+
+    __m256i p[MONT_VECS], ninv[MONT_VECS], r2[MONT_VECS], t[MONT_VECS], fix[MONT_VECS];
+
+    for (int j = 0; j < MONT_VECS; j++) {
+      p[j]    = _mm256_loadu_si256((const __m256i *) (primes + i + 4 * j));
+      ninv[j] = _mm256_cvtepu32_epi64(
+                _mm_loadu_si128((const __m128i *) (mont_ninv + i + 4 * j)));
+      r2[j]   = _mm256_cvtepu32_epi64(
+                _mm_loadu_si128((const __m128i *) (mont_r2 + i + 4 * j)));
+      t[j]    = _mm256_setzero_si256();
+      fix[j]  = redc32_avx2(r2[j], p[j], ninv[j]);
+    }
+
+    for (uint32_t k = 0; k < n_chunks; k++) {
+      const __m256i c = _mm256_set1_epi64x(chunks[k]);
+
+      for (int j = 0; j < MONT_VECS; j++)
+        t[j] = redc32_avx2(_mm256_add_epi64(t[j], c), p[j], ninv[j]);
+    }
+    
+    /* 2^(32 * (n_chunks + 1)) mod p */
+    for (uint32_t e = n_chunks; e > 0; e >>= 1) {
+      for (int j = 0; j < MONT_VECS; j++) {
+        if (e & 1)
+          fix[j] = redc32_avx2(_mm256_mul_epu32(fix[j], r2[j]), p[j], ninv[j]);
+
+        r2[j] = redc32_avx2(_mm256_mul_epu32(r2[j], r2[j]), p[j], ninv[j]);
+      }
+    }
+
+    for (int j = 0; j < MONT_VECS; j++)
+      _mm256_storeu_si256((__m256i *) (mods + i + 4 * j), redc32_avx2(_mm256_mul_epu32(t[j], fix[j]), p[j], ninv[j]));
+  }
+
+  return i;
+}
+#endif
+
+/**
+ * calculates mpz_n mod p for each sieve prime 
+ * (beginning after the presieve primes)
+ *
+ * With AVX2 (AVX-512) 4 (8) primes are reduced at once, each in its
+ * own 64 bit lane, and MONT_VECS vectors are interleaved to hide the
+ * multiplication latency: the 32 bit chunks of mpz_n are reduced from the 
+ * least significant one, t = (t + chunk) * 2^-32 mod p, which leaves 
+ * t = n * 2^(-32 * chunks) mod p. The final Montgomery multiplication 
+ * with 2^(32 * (chunks + 1)) mod p (an exponentiation of 2^64 mod p
+ * in Montgomery form) corrects this to n mod p.
+ *
+ * The kernel is selected by the instruction set of the cpu (isa).
+ * Primes >= 2^31 and the scalar fallback use mpz_tdiv_ui.
+ */
+void Sieve::calc_mods(sieve_t *mods, mpz_t mpz_n) {
+
+  sieve_t i = PRESIEVE_PRIMES + 1;
+
+#ifdef ISA_DISPATCH
+  if (isa >= ISA_AVX512)
+    i = calc_mods_avx512(mods, mpz_n, primes, mont_ninv, mont_r2, i, mont_end);
+  else if (isa == ISA_AVX2)
+    i = calc_mods_avx2(mods, mpz_n, primes, mont_ninv, mont_r2, i, mont_end);
+#endif
+
+  for (/* declared */; i < n_primes; i++)
+    mods[i] = mpz_tdiv_ui(mpz_n, primes[i]);
+
+  if (debug) {
+    bool result = true;
+
+    for (i = PRESIEVE_PRIMES + 1; i < n_primes && result; i++)
+      result = (mods[i] == mpz_tdiv_ui(mpz_n, primes[i]));
+
+    if (result)
+      printf("[DD] mods check [PASSED]\n");
+    else
+      printf("[EE] mods check [FAILED]\n");
+  }
+}
+
+/**
+ * prepares the residue engine for the given hash and shift
+ *
+ * hash mod p only depends on the 256 bit hash and is calculated
+ * once per hash, 2^shift mod p once per shift
+ */
+void Sieve::calc_residues(PoW *pow) {
+
+  mpz_t mpz_hash;
+  mpz_init(mpz_hash);
+  pow->get_hash(mpz_hash);
+
+  if (hash_mods == NULL || mpz_cmp(mpz_hash, mpz_mods_hash) != 0) {
+
+    if (hash_mods == NULL)
+      hash_mods = (sieve_t *) malloc(sizeof(sieve_t) * n_primes);
+
+    calc_mods(hash_mods, mpz_hash);
+
+    mpz_set(mpz_mods_hash, mpz_hash);
+  }
+
+  init_shift(pow->get_shift());
+  cur_pow2_mods = pow2_mods[pow->get_shift()];
+
+  mpz_clear(mpz_hash);
+}
+
+/**
+ * returns mpz_start mod primes[i]
+ *
+ * start = hash * 2^shift + offset
+ */
+inline sieve_t Sieve::start_mod(sieve_t i) {
+
+  const sieve_t p = primes[i];
+  sieve_t offset_mod;
+
+  if (mpz_fits_uint64_p(mpz_offset))
+    offset_mod = mpz_get_ui64(mpz_offset) % p;
+  else
+    offset_mod = mpz_tdiv_ui(mpz_offset, p);
+
+  sieve_t res = mulmod(hash_mods[i], cur_pow2_mods[i], p) + offset_mod;
+
+  return (res >= p) ? res - p : res;
+}
+
 /**
  * calculate for every prime the first
  * index in the sieve which is divisible by that prime
@@ -372,9 +1169,38 @@ void Sieve::init_primes(uint64_t n) {
  */
 void Sieve::calc_muls() {
 
-  for (sieve_t i = 0; i < n_primes; i++) {
+  if (layout == SIEVE_WHEEL30)
+    wheel_delta = mpz_tdiv_ui(mpz_start, 30);
+
+  calc_presieve();
 
-    starts[i] = primes[i] - mpz_tdiv_ui(mpz_start, primes[i]);
+  if (layout == SIEVE_WHEEL30) {
+
+    /**
+     * the number at wheel byte j bit b is divisible by p if
+     * start - wheel_delta + 30j + wheel30[b] = 0 (mod p)
+     * <=> j = -(start - wheel_delta + wheel30[b]) * 30^-1 (mod p)
+     */
+    for (sieve_t i = PRESIEVE_PRIMES + 1; i < n_primes; i++) {
+      
+      const sieve_t p = primes[i];
+      sieve_t base    = (start_mod(i) + p - wheel_delta) % p;
+
+      for (sieve_t b = 0; b < 8; b++) {
+        
+        uint64_t j = (2 * p - base - wheel30[b]) % p;
+        j = (j * wheel_inv[i]) % p;
+
+        starts[(i << 3) + b] = j * 8 + b;
+      }
+    }
+
+    return;
+  }
+
+  for (sieve_t i = PRESIEVE_PRIMES + 1; i < n_primes; i++) {
+
+    starts[i] = primes[i] - start_mod(i);
 
     if (starts[i] == primes[i])
       starts[i] = 0;
@@ -384,24 +1210,344 @@ void Sieve::calc_muls() {
      */
     if ((starts[i] & 1) == 0)
       starts[i] += primes[i];
+
+    /* odd offset to sieve bit */
+    starts[i] = odd_index(starts[i]);
+  }
+}
+
+/**
+ * advances the sieve indexes of each prime 
+ * from the last window to the following one
+ *
+ * After a completely sieved window the start index of each small prime
+ * points beyond the window, and each large prime is within the overflow
+ * bucket, so the indexes for the following window are just 
+ * window_bits lower. (The wheel offset stays the same, because the 
+ * wheel sievesize is divisible by 30.)
+ *
+ * The last wheel word overlaps with the following window, so an index
+ * can be one stride too far: its previous hit was within the overlap.
+ */
+void Sieve::roll_muls() {
+
+  calc_presieve();
+
+  for (sieve_t i = (PRESIEVE_PRIMES + 1) << prog_shift; 
+       i < (bucket_start << prog_shift); 
+       i++) {
+    
+    const sieve_t stride = primes[i >> prog_shift] << prog_shift;
+
+    starts[i] -= window_bits;
+    if (starts[i] >= stride)
+      starts[i] -= stride;
+  }
+
+  bucket_block_t *list = overflow;
+  overflow = NULL;
+
+  while (list != NULL) {
+    
+    bucket_block_t *block = list;
+    list = block->next;
+
+    for (uint32_t j = 0; j < block->size; j++) {
+      
+      const sieve_t prime  = block->overflow[j].prime;
+      const sieve_t stride = prime << prog_shift;
+      sieve_t index        = block->overflow[j].index;
+
+      if (index >= stride)
+        index -= stride;
+      
+      if (index < sieve_bits)
+        bucket_add(index, prime);
+      else
+        overflow_add(index, prime);
+    }
+
+    block->next = free_blocks;
+    free_blocks = block;
+  }
+}
+
+/**
+ * calculates the presieve pattern offsets for the current start
+ */
+void Sieve::calc_presieve() {
+
+  /**
+   * sieve unit m holds numbers a + step * m (+ wheel30[b]) with
+   * a = start + 1 for SIEVE_ODD and a = start - wheel_delta for SIEVE_WHEEL30,
+   * which have to be marked by a presieve pattern, if pattern unit m + r 
+   * is marked, with r = a / step (mod size). So we need the pattern word 
+   * offset j with j * units_per_word = r (mod size).
+   */
+  for (sieve_t g = 0; g < PRESIEVE_GROUPS; g++) {
+    
+    sieve_t size = presieve_size[g];
+    sieve_t a    = mpz_tdiv_ui(mpz_start, size);
+    sieve_t step = 2;
+
+    if (layout == SIEVE_WHEEL30) {
+      a    = (a + size - wheel_delta % size) % size;
+      step = 30;
+    } else 
+      a = (a + 1) % size;
+
+    sieve_t r = (a * inverse_mod(step % size, size)) % size;
+    presieve_offset[g] = (r * presieve_inv[g]) % size;
+  }
+}
+
+/**
+ * returns whether the given odd offset is still a prime candidate
+ */
+inline bool Sieve::is_candidate(sieve_t i) {
+
+  if (layout == SIEVE_WHEEL30) {
+    
+    const sieve_t n   = i + wheel_delta;
+    const sieve_t bit = wheel30_bit[n % 30];
+
+    return bit != 0xff && is_prime(sieve, (n / 30) * 8 + bit);
+  }
+
+  return is_odd_prime(sieve, i);
+}
+
+/**
+ * returns the offset of the given sieve bit
+ */
+inline sieve_t Sieve::bit_offset(sieve_t bit) {
+
+  if (layout == SIEVE_WHEEL30)
+    return (bit >> 3) * 30 + wheel30[bit & 7] - wheel_delta;
+
+  return 2 * bit + 1;
+}
+
+/**
+ * returns the smallest prime candidate offset >= i
+ */
+inline sieve_t Sieve::next_candidate(sieve_t i) {
+
+  sieve_t bit;
+  if (layout == SIEVE_WHEEL30) {
+    const sieve_t n = i + wheel_delta;
+
+    /* (wheel30_next 8 is bit 0 of the next byte) */
+    bit = (n / 30) * 8 + wheel30_next[n % 30];
+  } else
+    bit = odd_index(i);
+
+  const sieve_t n_words = sieve_bits >> SIEVE_WORD_SHIFT;
+  sieve_t word = bit >> SIEVE_WORD_SHIFT;
+
+  if (word >= n_words)
+    return sievesize + 1;
+
+  /* the candidate bits (unset) from bit on */
+  sieve_t bits = ~sieve[word] & (SIEVE_MAX << (bit & (SIEVE_WORD_BITS - 1)));
+
+  while (bits == 0) {
+    if (++word >= n_words)
+      return sievesize + 1;
+
+    bits = ~sieve[word];
+  }
+
+  return bit_offset((word << SIEVE_WORD_SHIFT) + sieve_ctz(bits));
+}
+
+/**
+ * returns the greatest prime candidate offset <= i
+ */
+inline sieve_t Sieve::prev_candidate(sieve_t i) {
+
+  sieve_t bit;
+  if (layout == SIEVE_WHEEL30) {
+    const sieve_t n = i + wheel_delta;
+    const sieve_t b = wheel30_prev[n % 30];
+    
+    if (b == 8 && n < 30)
+      return 0;
+
+    /* (wheel30_prev 8 is the last bit of the previous byte) */
+    bit = (b == 8) ? (n / 30) * 8 - 1 : (n / 30) * 8 + b;
+  } else {
+    if (i == 0)
+      return 0;
+
+    bit = odd_index(i - 1);
+  }
+
+  if (bit >= sieve_bits)
+    bit = sieve_bits - 1;
+
+  sieve_t word = bit >> SIEVE_WORD_SHIFT;
+
+  /* the candidate bits (unset) till bit */
+  sieve_t bits = ~sieve[word] & 
+                 (SIEVE_MAX >> (SIEVE_WORD_BITS - 1 - (bit & (SIEVE_WORD_BITS - 1))));
+
+  while (bits == 0) {
+    if (word == 0)
+      return 0;
+
+    bits = ~sieve[--word];
+  }
+
+  bit = (word << SIEVE_WORD_SHIFT) + SIEVE_WORD_BITS - 1 - sieve_clz(bits);
+
+  /* bits of the first wheel byte before the sieve start */
+  if (layout == SIEVE_WHEEL30 && (bit >> 3) * 30 + wheel30[bit & 7] <= wheel_delta)
+    return 0;
+
+  return bit_offset(bit);
+}
+
+/**
+ * returns a block of the given bucket list with 
+ * space for another one of max_size entries
+ */
+inline bucket_block_t *Sieve::bucket_block(bucket_block_t **bucket, 
+                                           uint32_t max_size) {
+
+  bucket_block_t *block = *bucket;
+
+  if (block == NULL || block->size == max_size) {
+    
+    if (free_blocks != NULL) {
+      block       = free_blocks;
+      free_blocks = block->next;
+    } else
+      block = (bucket_block_t *) malloc(sizeof(bucket_block_t));
+
+    block->next = *bucket;
+    block->size = 0;
+    *bucket     = block;
+  }
+
+  return block;
+}
+
+/**
+ * returns the blocks of the given bucket list to the free blocks
+ */
+void Sieve::bucket_free(bucket_block_t **bucket) {
+
+  while (*bucket != NULL) {
+    bucket_block_t *block = *bucket;
+    *bucket     = block->next;
+    block->next = free_blocks;
+    free_blocks = block;
   }
 }
 
 /**
- * Fermat pseudo prime test
+ * adds the given sieve index of the given prime (value) to its bucket
  */
-inline bool Sieve::fermat_test(mpz_t mpz_p) {
+inline void Sieve::bucket_add(sieve_t index, sieve_t prime) {
+
+  bucket_block_t *block = bucket_block(buckets + (index >> segment_shift), 
+                                       BUCKET_BLOCK_SIZE);
 
-  /* tmp = p - 1 */
-  mpz_sub_ui(mpz_e, mpz_p, 1);
+  block->entries[block->size].index = index & (segment_size - 1);
+  block->entries[block->size].prime = prime;
+  block->size++;
+}
 
-  /* res = 2^tmp mod p */
-  mpz_powm(mpz_r, mpz_two, mpz_e, mpz_p);
+/**
+ * adds the given sieve index of the given prime (value) 
+ * beyond the current window to the overflow bucket,
+ * relative to the start of the following window
+ */
+inline void Sieve::overflow_add(sieve_t index, sieve_t prime) {
+
+  bucket_block_t *block = bucket_block(&overflow, OVERFLOW_BLOCK_SIZE);
+
+  block->overflow[block->size].index = index - window_bits;
+  block->overflow[block->size].prime = prime;
+  block->size++;
+}
+
+/**
+ * files each large prime into the bucket of the
+ * segment containing its start index
+ */
+void Sieve::fill_buckets() {
 
-  if (mpz_cmp_ui(mpz_r, 1) == 0)
-    return true;
+  bucket_free(&overflow);
 
-  return false;
+  for (sieve_t i = bucket_start << prog_shift; i < (n_primes << prog_shift); i++) {
+    if (starts[i] < sieve_bits)
+      bucket_add(starts[i], primes[i >> prog_shift]);
+    else
+      overflow_add(starts[i], primes[i >> prog_shift]);
+  }
+}
+
+/**
+ * crosses off all sieve primes within the bits [seg_start, seg_end),
+ * the start index of each prime is carried over to the next segment
+ *
+ * Primes greater than the segment size are processed using the buckets
+ * (Oliveira e Silva), so only the primes actually hitting this segment
+ * are touched. Each one is refiled into the bucket of its next segment.
+ */
+void Sieve::sieve_segment(sieve_t seg_start, sieve_t seg_end) {
+
+  /* clear the segment and cross off the presieve primes */
+  run_presieve(seg_start / (sizeof(sieve_t) * 8), seg_end / (sizeof(sieve_t) * 8));
+
+  /* sieve all remaining small primes */
+  for (sieve_t i = PRESIEVE_PRIMES + 1; i < bucket_start; i++) {
+
+    const sieve_t stride = primes[i] << prog_shift;
+    sieve_t *prog        = starts + (i << prog_shift);
+
+    /**
+     * sieve all odd multiplies of the current prime
+     * (which are primes[i] bits apart, or 8 * primes[i] bits
+     * within each wheel residue)
+     */
+    for (sieve_t k = 0; k < ((sieve_t) 1 << prog_shift); k++) {
+    
+      sieve_t p;
+      for (p = prog[k]; p < seg_end; p += stride)
+        set_composite(sieve, p);
+
+      prog[k] = p;
+    }
+  }
+
+  /* sieve all large primes hitting this segment */
+  sieve_t segment = seg_start >> segment_shift;
+  
+  while (buckets[segment] != NULL) {
+    
+    bucket_block_t *block = buckets[segment];
+    buckets[segment] = block->next;
+
+    for (uint32_t j = 0; j < block->size; j++) {
+
+      sieve_t prime = block->entries[j].prime;
+      sieve_t p     = seg_start + block->entries[j].index;
+
+      set_composite(sieve, p);
+      p += prime << prog_shift;
+
+      if (p < sieve_bits)
+        bucket_add(p, prime);
+      else
+        overflow_add(p, prime);
+    }
+
+    block->next = free_blocks;
+    free_blocks = block;
+  }
 }
 
 /**
@@ -443,8 +1589,8 @@ bool Sieve::is_sieve_valid(sieve_t db_break) {
     
     mpz_add_ui(mpz_p, mpz_start, i);
 
-    /* is_prime(sieve, i) <=> miller_rabin_test(start + i) */
-    result = !(is_prime(sieve, i) xor (mpz_probab_prime_p(mpz_p, 25) > 0));
+    /* is_candidate(i) <=> miller_rabin_test(start + i) */
+    result = !(is_candidate(i) xor (mpz_probab_prime_p(mpz_p, 25) > 0));
   }
 
   mpz_clear(mpz_p);
@@ -460,13 +1606,12 @@ bool Sieve::are_primes_valid() {
   mpz_init_set_ui64(mpz_next, 0);
   mpz_init_set_ui64(mpz_p, 2);
   
-  bool result = primes[0] == 2 && primes2[0] == (2 << 1);
+  bool result = primes[0] == 2;
 
   for (sieve_t i = 1; i < n_primes && result; i++) {
     
     mpz_nextprime(mpz_next, mpz_p);
-    result = mpz_get_ui64(mpz_next) == primes[i] && 
-             (mpz_get_ui64(mpz_next) << 1) == primes2[i];
+    result = mpz_get_ui64(mpz_next) == primes[i];
 
     if (!result)
       printf("[EE] primes[%" PRISIEVE "] = %" PRISIEVE
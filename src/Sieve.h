@@ -24,8 +24,12 @@
 #include <math.h>
 #include <gmp.h>
 #include <mpfr.h>
+#include <map>
+#include <atomic>
 
 #include "PoW.h"
+#include "Isa.h"
+#include "Fermat.h"
 #include "PoWUtils.h"
 #include "PoWProcessor.h"
 
@@ -73,6 +77,21 @@ using namespace std;
  */
 #define set_composite(ary, i) set_bit(ary, i)
 
+/**
+ * the mining sieve only stores odd offsets: bit k stands for offset 2k + 1
+ */
+#define odd_index(i) ((i) >> 1)
+
+/**
+ * returns whether the given odd offset in an odd only sieve is a prime or not
+ */
+#define is_odd_prime(ary, i) is_prime(ary, odd_index(i))
+
+/**
+ * marks the given odd offset in an odd only sieve as composite
+ */
+#define set_odd_composite(ary, i) set_composite(ary, odd_index(i))
+
 /**
  * sets x to the next greater number divisible by y
  */
@@ -88,6 +107,12 @@ using namespace std;
  */
 #define POW(X) ((X) * (X))
 
+/**
+ * default size of a sieve segment in bits,
+ * one segment should fit into the L2 cache
+ */
+#define SIEVE_SEGMENT_SIZE (256 * 1024 * 8)
+
 /**
  * define the sieve array word size
  */
@@ -96,13 +121,174 @@ using namespace std;
 #define ssieve_t int64_t
 #define SIEVE_MAX UINT64_MAX
 #define PRISIEVE PRIu64
+#define SIEVE_WORD_SHIFT 6
 #else
 #define sieve_t uint32_t
 #define ssieve_t int32_t
 #define SIEVE_MAX UINT32_MAX
 #define PRISIEVE PRIu32
+#define SIEVE_WORD_SHIFT 5
 #endif
 
+/**
+ * number of bits of a sieve word
+ */
+#define SIEVE_WORD_BITS (((sieve_t) 1) << SIEVE_WORD_SHIFT)
+
+/**
+ * number of trailing (leading) zero bits of a non zero sieve word
+ * (bsf / bsr, or tzcnt / lzcnt if built with -mbmi / -mlzcnt,
+ * there is no runtime cpu check)
+ */
+#if __WORDSIZE == 64
+#define sieve_ctz(x) __builtin_ctzll(x)
+#define sieve_clz(x) __builtin_clzll(x)
+#else
+#define sieve_ctz(x) __builtin_ctz(x)
+#define sieve_clz(x) __builtin_clz(x)
+#endif
+
+/**
+ * number of the smallest odd primes (3 till 31) which are not
+ * crossed off, but stamped into the sieve using precomputed patterns
+ */
+#define PRESIEVE_PRIMES 10
+
+/**
+ * the presieve primes are combined into this number of patterns
+ */
+#define PRESIEVE_GROUPS 4
+
+/**
+ * the available sieve encodings
+ */
+typedef enum {
+
+  /* one bit per odd offset */
+  SIEVE_ODD,
+
+  /* one bit per number coprime to 30, 8 residues per byte */
+  SIEVE_WHEEL30
+} sieve_layout_t;
+
+/**
+ * number of interleaved vectors in the Montgomery remainder kernel
+ */
+#define MONT_VECS 4
+
+/**
+ * number of entries within one bucket block
+ */
+#define BUCKET_BLOCK_SIZE 1024
+
+/**
+ * the sieve primes are limited to the primes below 2^32 
+ * (the number of these), so bucket entries can store them in 32 bits
+ */
+#define MAX_SIEVE_PRIMES 203280221
+
+/**
+ * the next sieve index of a large prime, filed into the bucket
+ * of the segment containing that index
+ */
+typedef struct {
+  
+  /* sieve index relative to the segment start */
+  uint32_t index;
+
+  /* the prime itself, so refiling needs no random access into primes */
+  uint32_t prime;
+} bucket_entry_t;
+
+/**
+ * the next sieve index of a large prime beyond the current window
+ */
+typedef struct {
+
+  /**
+   * sieve index relative to the following window 
+   * (up to 8 * prime in the wheel layout, so it needs a sieve_t)
+   */
+  sieve_t index;
+
+  uint32_t prime;
+} overflow_entry_t;
+
+/**
+ * number of entries within one overflow block (of the same size)
+ */
+#define OVERFLOW_BLOCK_SIZE \
+  (BUCKET_BLOCK_SIZE * sizeof(bucket_entry_t) / sizeof(overflow_entry_t))
+
+/**
+ * a block of bucket entries, the buckets are linked lists of these
+ * (the blocks of the overflow bucket hold overflow entries)
+ */
+typedef struct bucket_block_t {
+  
+  /* the next block of the same bucket */
+  struct bucket_block_t *next;
+
+  /* number of used entries */
+  uint32_t size;
+
+  union {
+    bucket_entry_t entries[BUCKET_BLOCK_SIZE];
+    overflow_entry_t overflow[OVERFLOW_BLOCK_SIZE];
+  };
+} bucket_block_t;
+
+
+/**
+ * a sieved window, handed from one sieve to another
+ * (see Sieve::get_window and Sieve::set_window)
+ */
+typedef struct {
+
+  /* the sieve bitmap */
+  sieve_t *sieve;
+
+  /* the start of the sieve */
+  mpz_t mpz_start;
+
+  /* the offset of the window */
+  mpz_t mpz_offset;
+
+  /* start mod 30 (SIEVE_WHEEL30 only) */
+  sieve_t wheel_delta;
+} sieve_window_t;
+
+/**
+ * maximal number of gap scan cursors: each scans its own range of a 
+ * window, so that the fermat tests of Fermat::get_lanes() of them can be 
+ * batched (4 cursors per lane, a single one without batching)
+ */
+#define SCAN_MAX_CURSORS (4 * FERMAT_MAX_LANES)
+
+/**
+ * a gap scan cursor, it reports the gaps starting within [*, end)
+ */
+typedef struct {
+
+  /* the next offset to test */
+  sieve_t i;
+
+  /* the end of the cursor's range */
+  sieve_t end;
+
+  /* the current prime (gap start) */
+  sieve_t start;
+
+  /* the start of the last reported gap and the end of its scan */
+  sieve_t reported;
+  sieve_t scan_end;
+
+  /* still searching the first prime */
+  bool first;
+
+  /* the cursor's range is scanned */
+  bool done;
+} scan_cursor_t;
 
 class Sieve {
 
@@ -118,7 +304,10 @@ class Sieve {
     /**
      * create a new Sieve
      */
-    Sieve(PoWProcessor *pprocessor, uint64_t n_primes, uint64_t sievesize);
+    Sieve(PoWProcessor *pprocessor, 
+          uint64_t n_primes, 
+          uint64_t sievesize,
+          sieve_layout_t layout = SIEVE_ODD);
 
     ~Sieve();
 
@@ -126,6 +315,20 @@ class Sieve {
      * sets the PoWProcessor of this
      */
     void set_pprocessor(PoWProcessor *pprocessor);
+
+    /**
+     * precalculates 2^shift mod p of each sieve prime for the given shift,
+     * so that the sieve start residues of a new block hash are fast to
+     * calculate (otherwise this is done on the first use of a shift)
+     */
+    void init_shift(uint16_t shift);
+
+    /**
+     * sets the size in bits of the segments the sieve is processed in
+     * (rounded up to a power of two of at least the sieve word size,
+     * 0 sieves all in one segment)
+     */
+    void set_segment_size(uint64_t segment_size);
  
     /** 
      * sieve for the given header hash 
@@ -134,6 +337,46 @@ class Sieve {
      *         or NULL if no such prime was found
      */
    void run_sieve(PoW *pow, vector<uint8_t> *offset);
+
+    /** 
+     * sieve for the given header hash at the given offset (mpz version)
+     */
+   void run_sieve(PoW *pow, mpz_t mpz_offset);
+
+    /**
+     * sieve the window following the last sieved one 
+     * (last offset + sievesize) for the given header hash.
+     *
+     * As long as the sieve start continues the last window, the sieve
+     * indexes of each prime are derived from the last window using only
+     * word arithmetic, instead of recalculating them from the new start.
+     * (run_sieve detects such a continuation automatically)
+     */
+   void run_sieve_next(PoW *pow);
+
+    /**
+     * the two stages of run_sieve: sieve_window sieves the window at 
+     * the given offset, scan_window scans the current window for prime
+     * gaps and accounts the speed statistics from start_time 
+     * (in usec, 0 means now)
+     */
+    void sieve_window(PoW *pow, mpz_t mpz_offset);
+    void scan_window(PoW *pow, uint64_t start_time = 0);
+
+    /**
+     * allocates (frees) a window buffer matching this sieve
+     */
+    void init_window(sieve_window_t *window);
+    void clear_window(sieve_window_t *window);
+
+    /**
+     * moves the sieved window into the given buffer, so that another
+     * sieve (with the same size and layout) can scan it by set_window,
+     * while this one sieves the next window. 
+     * (the window memory is swapped, not copied)
+     */
+    void get_window(sieve_window_t *window);
+    void set_window(sieve_window_t *window);
  
     /**
      * returns the primes per seconds
@@ -175,6 +418,18 @@ class Sieve {
      */
     uint64_t get_found_primes();
 
+    /**
+     * returns the number of offsets covered by one window
+     * (the requested sieve size rounded to the sieve layout)
+     */
+    uint64_t get_sievesize();
+
+    /**
+     * returns the instruction set of the sieve and fermat kernels,
+     * selected at construction by the cpu features (see isa_detect)
+     */
+    isa_t get_isa();
+
   protected :
 
     /* number of sieve filter primes */
@@ -183,47 +438,157 @@ class Sieve {
     /* array of the first n primes */
     sieve_t *primes;
 
-    /* array of the first n primes * 2 */
-    sieve_t *primes2;
- 
     /**
-     * array of the start indexes for each prime.
+     * array of the start indexes (sieve bits) for each prime.
      * while sieving the current hash
+     * (1 << prog_shift sieve progressions per prime)
      */
     sieve_t *starts;
  
-    /* sieve size in bits */
+    /* sieve size (number of offsets covered by the sieve) */
     sieve_t sievesize;
+
+    /* number of sieve bits */
+    sieve_t sieve_bits;
+
+    /**
+     * number of sieve bits one window advances the following one
+     * (sievesize / 2 for SIEVE_ODD, sievesize * 8 / 30 for SIEVE_WHEEL30)
+     */
+    sieve_t window_bits;
+
+    /* the encoding of the sieve */
+    sieve_layout_t layout;
+
+    /**
+     * log2 of the sieve progressions per prime, a progression of 
+     * prime p crosses off every (p << prog_shift)th sieve bit:
+     * 0 for SIEVE_ODD, 3 for SIEVE_WHEEL30 (one per wheel residue)
+     */
+    sieve_t prog_shift;
+
+    /* 30^-1 mod p for each prime (SIEVE_WHEEL30 only) */
+    sieve_t *wheel_inv;
+
+    /**
+     * start mod 30, wheel byte j bit b stands for 
+     * offset 30j + wheel30[b] - wheel_delta (SIEVE_WHEEL30 only)
+     */
+    sieve_t wheel_delta;
+
+    /* segment size in bits */
+    sieve_t segment_size;
+
+    /* log2 of the segment size */
+    sieve_t segment_shift;
+
+    /**
+     * index of the first prime greater than the segment size,
+     * all primes from here on are sieved using buckets
+     */
+    sieve_t bucket_start;
+
+    /* number of buckets (one per segment) */
+    sieve_t n_buckets;
+
+    /* the bucket list of each segment */
+    bucket_block_t **buckets;
+
+    /**
+     * the large primes not hitting the current window anymore,
+     * with their sieve index relative to the following window
+     */
+    bucket_block_t *overflow;
+
+    /* unused bucket blocks */
+    bucket_block_t *free_blocks;
+
+    /**
+     * whether starts and the overflow bucket hold the state
+     * after a completely sieved window
+     */
+    bool window_done;
+
+    /**
+     * the presieve patterns, each one marks all multiples of 
+     * a group of small primes and repeats after its size in words
+     */
+    sieve_t *presieve[PRESIEVE_GROUPS];
+
+    /* the size in words of each presieve pattern */
+    sieve_t presieve_size[PRESIEVE_GROUPS];
+
+    /* the inverse of the pattern units per word modulo each pattern size */
+    sieve_t presieve_inv[PRESIEVE_GROUPS];
+
+    /**
+     * the word offset of each pattern matching the current sieve start
+     */
+    sieve_t presieve_offset[PRESIEVE_GROUPS];
  
-    /* the sieve as an ary of 64 bit words */
+    /* the sieve as an ary of 64 bit words (see layout) */
     sieve_t *sieve;
  
     /* the start of the sieve */
     mpz_t mpz_start;
+
+    /* the offset of the last sieved window */
+    mpz_t mpz_offset;
+
+    /**
+     * residue engine: start mod p is calculated from
+     * (hash mod p) * (2^shift mod p) + (offset mod p)
+     */
+
+    /* the hash of hash_mods */
+    mpz_t mpz_mods_hash;
+
+    /* hash mod p for each prime (NULL till the first hash) */
+    sieve_t *hash_mods;
+
+    /* 2^shift mod p for each prime and each used shift */
+    map<uint16_t, sieve_t *> pow2_mods;
+
+    /* 2^shift mod p of the current shift */
+    sieve_t *cur_pow2_mods;
+
+    /* index of the first prime >= 2^31 (end of the Montgomery constants) */
+    sieve_t mont_end;
+
+    /* instruction set of the SIMD kernels */
+    isa_t isa;
+
+    /* -p^-1 mod 2^32 for each prime < 2^31 */
+    uint32_t *mont_ninv;
+
+    /* 2^64 mod p for each prime < 2^31 */
+    uint32_t *mont_r2;
  
+    /* statistics, updated once per window and read by other threads */
+
     /* overall found primes */
-    uint64_t found_primes;
+    std::atomic<uint64_t> found_primes;
 
     /* overall prime gaps */
-    uint64_t n_gaps;
+    std::atomic<uint64_t> n_gaps;
 
     /* current prime gaps */
-    uint64_t cur_n_gaps;
+    std::atomic<uint64_t> cur_n_gaps;
 
     /* overall prime tests */
-    uint64_t tests;
+    std::atomic<uint64_t> tests;
 
     /* current prime tests */
-    uint64_t cur_tests;
+    std::atomic<uint64_t> cur_tests;
 
     /* passed time mining */
-    uint64_t passed_time;
+    std::atomic<uint64_t> passed_time;
 
     /* current found primes */
-    uint64_t cur_found_primes;
+    std::atomic<uint64_t> cur_found_primes;
 
     /* time passed since the last interval */
-    uint64_t cur_passed_time;
+    std::atomic<uint64_t> cur_passed_time;
 
     /* callback object to process an calculated PoW */
     PoWProcessor *pprocessor;
@@ -235,17 +600,125 @@ class Sieve {
      * Generates the first n primes using the sieve of Eratosthenes
      */
     void init_primes(uint64_t n);
+
+    /**
+     * calculates 30^-1 mod p for the wheel encoding
+     */
+    void init_wheel();
+
+    /**
+     * Generates the presieve patterns
+     */
+    void init_presieve();
+
+    /**
+     * stamps the presieve patterns into the words [start, end) of the sieve
+     */
+    void run_presieve(sieve_t start, sieve_t end);
  
+    /**
+     * calculates the Montgomery constants for calc_mods
+     */
+    void init_mods();
+
+    /**
+     * calculates mpz_n mod p for each sieve prime 
+     * (beginning after the presieve primes)
+     */
+    void calc_mods(sieve_t *mods, mpz_t mpz_n);
+
+    /**
+     * prepares the residue engine for the given hash and shift
+     */
+    void calc_residues(PoW *pow);
+
+    /**
+     * returns mpz_start mod primes[i]
+     */
+    inline sieve_t start_mod(sieve_t i);
+
     /**
      * calculate the sieve start indexes;
      */
     void calc_muls();
- 
+
+    /**
+     * calculates the presieve pattern offsets for the current start
+     */
+    void calc_presieve();
+
+    /**
+     * advances the sieve indexes of each prime 
+     * from the last window to the following one
+     */
+    void roll_muls();
+
+    /**
+     * crosses off all sieve primes within the bits [seg_start, seg_end)
+     * and advances their start indexes to the next segment
+     */
+    void sieve_segment(sieve_t seg_start, sieve_t seg_end);
+
+    /**
+     * files each large prime into the bucket of the
+     * segment containing its start index
+     */
+    void fill_buckets();
+
+    /**
+     * adds the given sieve index of the given prime (value) to its bucket
+     */
+    inline void bucket_add(sieve_t index, sieve_t prime);
+
+    /**
+     * adds the given sieve index of the given prime (value) 
+     * beyond the current window to the overflow bucket
+     */
+    inline void overflow_add(sieve_t index, sieve_t prime);
+
+    /**
+     * returns a block of the given bucket list with 
+     * space for another one of max_size entries
+     */
+    inline bucket_block_t *bucket_block(bucket_block_t **bucket, 
+                                        uint32_t max_size);
+
     /**
-     * Fermat pseudo prime test
+     * returns the blocks of the given bucket list to the free blocks
      */
-    inline bool fermat_test(mpz_t mpz_p);
+    void bucket_free(bucket_block_t **bucket);
  
+    /**
+     * returns whether the given odd offset is still a prime candidate
+     */
+    inline bool is_candidate(sieve_t i);
+
+    /**
+     * returns the offset of the given sieve bit
+     */
+    inline sieve_t bit_offset(sieve_t bit);
+
+    /**
+     * candidate iterators of the gap scan: return the smallest
+     * prime candidate offset >= i (> sievesize if there is none), and
+     * the greatest one <= i (0 if there is none). Whole words without
+     * a candidate are skipped at once.
+     */
+    inline sieve_t next_candidate(sieve_t i);
+    inline sieve_t prev_candidate(sieve_t i);
+
+    /**
+     * advances the gap scan cursor c by the fermat test result of c->i
+     * to the next offset it has to test, returns true if the 
+     * PoWProcessor stops the scan
+     */
+    inline bool scan_cursor(scan_cursor_t *c, 
+                            bool prime, 
+                            PoW *pow, 
+                            sieve_t min_len, 
+                            mpz_t mpz_adder,
+                            uint64_t *gap_count);
+
     /**
      * verifies a given gap
      */
@@ -264,6 +737,9 @@ class Sieve {
   private :
 
     /* primality testing */
-    mpz_t mpz_e, mpz_r, mpz_two;
+    Fermat *fermat;
+
+    /* number of gap scan cursors */
+    int scan_cursors;
 };
 #endif /* __PRIME_H__ */
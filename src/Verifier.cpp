@@ -0,0 +1,549 @@
+/**
+ * Implementation of the prime search used to validate a PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#include <stdlib.h>
+#include <string.h>
+#include <limits.h>
+#include <math.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <gmp.h>
+
+#include "Verifier.h"
+
+const uint32_t      *Verifier::primes      = NULL;
+const unsigned long *Verifier::group_prods = NULL;
+const uint32_t      *Verifier::group_ends  = NULL;
+uint32_t             Verifier::n_groups    = 0;
+
+static pthread_once_t primes_once = PTHREAD_ONCE_INIT;
+
+/**
+ * thread entry point of a parallel search
+ */
+static void *verifier_worker_main(void *args) {
+
+  verifier_worker_t *worker = (verifier_worker_t *) args;
+  worker->verifier->run_search(worker->search);
+
+  return NULL;
+}
+
+Verifier::Verifier(prime_test_t test) {
+
+  this->test = test;
+
+  mpz_init(mpz_base);
+  mpz_init(mpz_d);
+  mpz_init(mpz_x);
+  mpz_init(mpz_u);
+  mpz_init(mpz_v);
+  mpz_init(mpz_candidate);
+
+  max_window = 0;
+  window     = NULL;
+  n_threads  = 0;
+  workers    = NULL;
+  set_threads(1);
+
+  pthread_once(&primes_once, init_primes);
+}
+
+Verifier::~Verifier() {
+
+  for (uint32_t i = 1; i < n_threads; i++)
+    delete workers[i].verifier;
+
+  mpz_clear(mpz_base);
+  mpz_clear(mpz_d);
+  mpz_clear(mpz_x);
+  mpz_clear(mpz_u);
+  mpz_clear(mpz_v);
+  mpz_clear(mpz_candidate);
+
+  free(workers);
+  free(window);
+}
+
+/**
+ * generates the sieve primes and their groups (once)
+ */
+void Verifier::init_primes() {
+
+  /* sieve of Eratosthenes over the odd numbers up to the last prime */
+  const uint64_t n = VERIFIER_PRIMES + 1;
+  const uint64_t limit = n * log(n) + n * log(log(n));
+
+  uint8_t *composite = (uint8_t *) calloc(limit / 2 + 1, 1);
+  uint32_t *ps = (uint32_t *) malloc(sizeof(uint32_t) * VERIFIER_PRIMES);
+  uint32_t n_primes = 0;
+
+  for (uint64_t p = 3; n_primes < VERIFIER_PRIMES; p += 2) {
+    if (composite[p / 2])
+      continue;
+
+    ps[n_primes++] = p;
+    for (uint64_t i = p * p; i <= limit; i += 2 * p)
+      composite[i / 2] = 1;
+  }
+  free(composite);
+
+  unsigned long *prods = (unsigned long *) malloc(sizeof(unsigned long) * VERIFIER_PRIMES);
+  uint32_t *ends       = (uint32_t *) malloc(sizeof(uint32_t) * VERIFIER_PRIMES);
+
+  for (uint32_t i = 0; i < VERIFIER_PRIMES; n_groups++) {
+
+    unsigned long prod = ps[i++];
+    while (i < VERIFIER_PRIMES && prod <= ULONG_MAX / ps[i])
+      prod *= ps[i++];
+
+    prods[n_groups] = prod;
+    ends[n_groups]  = i;
+  }
+
+  primes      = ps;
+  group_prods = prods;
+  group_ends  = ends;
+}
+
+/**
+ * sets / returns the probable prime test
+ */
+void Verifier::set_prime_test(prime_test_t test) {
+  
+  this->test = test;
+
+  for (uint32_t i = 1; i < n_threads; i++)
+    workers[i].verifier->set_prime_test(test);
+}
+
+prime_test_t Verifier::get_prime_test() {
+  return test;
+}
+
+/**
+ * sets / returns the number of threads of a search
+ */
+void Verifier::set_threads(uint32_t n_threads) {
+
+  if (n_threads == 0) {
+    long n_cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    n_threads   = (n_cpus > 0) ? n_cpus : 1;
+  }
+
+  for (uint32_t i = 1; i < this->n_threads; i++)
+    delete workers[i].verifier;
+
+  free(workers);
+  this->n_threads = n_threads;
+  this->workers   = (verifier_worker_t *) malloc(sizeof(verifier_worker_t) *
+                                                 n_threads);
+
+  for (uint32_t i = 0; i < n_threads; i++) {
+    workers[i].verifier = (i == 0) ? this : new Verifier(test);
+    workers[i].search   = NULL;
+    workers[i].running  = false;
+  }
+}
+
+uint32_t Verifier::get_threads() {
+  return n_threads;
+}
+
+/**
+ * returns whether mpz_n is a probable prime by the selected test
+ */
+bool Verifier::is_prime(mpz_t mpz_n) {
+
+  if (test == PRIME_TEST_MR25)
+    return mpz_probab_prime_p(mpz_n, 25);
+
+  if (mpz_cmp_ui(mpz_n, 2) <= 0)
+    return mpz_cmp_ui(mpz_n, 2) == 0;
+
+  if (mpz_even_p(mpz_n))
+    return false;
+
+  return strong_base2(mpz_n) && strong_lucas(mpz_n);
+}
+
+/**
+ * strong probable prime test to base 2 of the odd mpz_n > 2:
+ * with n - 1 = d * 2^s (d odd), 2^d = 1 or 2^(d * 2^r) = -1 (mod n) 
+ * for some r < s
+ */
+bool Verifier::strong_base2(mpz_t mpz_n) {
+
+  mpz_sub_ui(mpz_d, mpz_n, 1);
+  const mp_bitcnt_t s = mpz_scan1(mpz_d, 0);
+  mpz_tdiv_q_2exp(mpz_d, mpz_d, s);
+
+  mpz_set_ui(mpz_x, 2);
+  mpz_powm(mpz_x, mpz_x, mpz_d, mpz_n);
+
+  /* n - 1 */
+  mpz_sub_ui(mpz_d, mpz_n, 1);
+
+  if (mpz_cmp_ui(mpz_x, 1) == 0 || mpz_cmp(mpz_x, mpz_d) == 0)
+    return true;
+
+  for (mp_bitcnt_t r = 1; r < s; r++) {
+    mpz_mul(mpz_x, mpz_x, mpz_x);
+    mpz_mod(mpz_x, mpz_x, mpz_n);
+
+    if (mpz_cmp(mpz_x, mpz_d) == 0)
+      return true;
+
+    if (mpz_cmp_ui(mpz_x, 1) == 0)
+      return false;
+  }
+
+  return false;
+}
+
+/**
+ * extra strong Lucas probable prime test of the odd mpz_n > 2
+ *
+ * With the first P of 3, 4, 5, ... with jacobi(P^2 - 4, n) = -1 and Q = 1:
+ * n + 1 = d * 2^s (d odd), U_d = 0 and V_d = +-2, or V_(d * 2^r) = 0 
+ * (mod n) for some r < s - 1. Only the V sequence is calculated, 
+ * (V_k, V_k+1) left to right by
+ *
+ *   V_2k = V_k^2 - 2,  V_2k+1 = V_k V_k+1 - P
+ *
+ * and U_d = 0 is the same as 2 V_d+1 = P V_d (mod n).
+ */
+bool Verifier::strong_lucas(mpz_t mpz_n) {
+
+  /* there is no such P for squares */
+  if (mpz_perfect_square_p(mpz_n))
+    return false;
+
+  unsigned long P = 3;
+  for (;;) {
+    const int jacobi = mpz_si_kronecker(P * P - 4, mpz_n);
+
+    if (jacobi == -1)
+      break;
+
+    if (jacobi == 0 && mpz_cmp_ui(mpz_n, P * P - 4) > 0)
+      return false;
+
+    P++;
+  }
+
+  mpz_add_ui(mpz_d, mpz_n, 1);
+  const mp_bitcnt_t s = mpz_scan1(mpz_d, 0);
+  mpz_tdiv_q_2exp(mpz_d, mpz_d, s);
+
+  /* (V_1, V_2) */
+  mpz_set_ui(mpz_u, P);
+  mpz_set_ui(mpz_v, P * P - 2);
+  mpz_mod(mpz_u, mpz_u, mpz_n);
+  mpz_mod(mpz_v, mpz_v, mpz_n);
+
+  for (mp_bitcnt_t i = mpz_sizeinbase(mpz_d, 2) - 1; i > 0; i--) {
+
+    if (mpz_tstbit(mpz_d, i - 1)) {
+
+      /* (V_2k+1, V_2k+2) */
+      mpz_mul(mpz_u, mpz_u, mpz_v);
+      mpz_sub_ui(mpz_u, mpz_u, P);
+      mpz_mod(mpz_u, mpz_u, mpz_n);
+
+      mpz_mul(mpz_v, mpz_v, mpz_v);
+      mpz_sub_ui(mpz_v, mpz_v, 2);
+      mpz_mod(mpz_v, mpz_v, mpz_n);
+    } else {
+
+      /* (V_2k, V_2k+1) */
+      mpz_mul(mpz_v, mpz_u, mpz_v);
+      mpz_sub_ui(mpz_v, mpz_v, P);
+      mpz_mod(mpz_v, mpz_v, mpz_n);
+
+      mpz_mul(mpz_u, mpz_u, mpz_u);
+      mpz_sub_ui(mpz_u, mpz_u, 2);
+      mpz_mod(mpz_u, mpz_u, mpz_n);
+    }
+  }
+
+  /* U_d = 0: 2 V_d+1 = P V_d */
+  mpz_mul_2exp(mpz_v, mpz_v, 1);
+  mpz_submul_ui(mpz_v, mpz_u, P);
+  mpz_mod(mpz_v, mpz_v, mpz_n);
+
+  if (mpz_sgn(mpz_v) == 0) {
+
+    /* V_d = +-2 */
+    if (mpz_cmp_ui(mpz_u, 2) == 0)
+      return true;
+
+    mpz_add_ui(mpz_x, mpz_u, 2);
+    if (mpz_cmp(mpz_x, mpz_n) == 0)
+      return true;
+  }
+
+  for (mp_bitcnt_t r = 0; r + 1 < s; r++) {
+    if (mpz_sgn(mpz_u) == 0)
+      return true;
+
+    mpz_mul(mpz_u, mpz_u, mpz_u);
+    mpz_sub_ui(mpz_u, mpz_u, 2);
+    mpz_mod(mpz_u, mpz_u, mpz_n);
+  }
+
+  return false;
+}
+
+/**
+ * marks the composites of the size odd candidates mpz_base + 2i
+ * with the first n_primes sieve primes
+ */
+void Verifier::sieve_window(uint64_t size, uint32_t n_primes) {
+
+  memset(window, 0, size);
+
+  uint32_t i = 0;
+  for (uint32_t g = 0; i < n_primes; g++) {
+
+    /* one multi precision division per group */
+    const unsigned long group_mod = mpz_tdiv_ui(mpz_base, group_prods[g]);
+
+    for (/* declared */; i < group_ends[g]; i++) {
+
+      const uint64_t p = primes[i];
+
+      /* mpz_base + 2j = 0 (mod p) for j = -mpz_base * 2^-1 (mod p) */
+      const uint64_t mod = group_mod % p;
+      for (uint64_t j = ((p - mod) % p) * ((p + 1) / 2) % p; j < size; j += p)
+        window[j] = 1;
+    }
+  }
+}
+
+/**
+ * makes sure the window fits size candidates
+ */
+void Verifier::reserve_window(uint64_t size) {
+
+  if (size > max_window) {
+    free(window);
+    window     = (uint8_t *) malloc(size);
+    max_window = size;
+  }
+}
+
+/**
+ * sets mpz_end to the next probable prime greater than mpz_start,
+ * with limit > 0 only up to mpz_start + limit
+ */
+bool Verifier::next_prime(mpz_t mpz_end, mpz_t mpz_start, uint64_t limit) {
+  return search(mpz_end, mpz_start, limit, NULL);
+}
+
+/**
+ * next_prime without limit, which tests mpz_prime along the search
+ */
+bool Verifier::test_and_next_prime(mpz_t mpz_end, 
+                                   mpz_t mpz_start, 
+                                   mpz_t mpz_prime) {
+  return search(mpz_end, mpz_start, 0, mpz_prime);
+}
+
+/**
+ * next_prime and test_and_next_prime
+ */
+bool Verifier::search(mpz_t mpz_end, 
+                      mpz_t mpz_start, 
+                      uint64_t limit, 
+                      mpz_t mpz_prime) {
+
+  /* the sieve would mark the sieve primes themselves */
+  if (mpz_cmp_ui(mpz_start, primes[VERIFIER_PRIMES - 1]) <= 0) {
+    if (mpz_prime != NULL && !is_prime(mpz_prime))
+      return false;
+
+    mpz_nextprime(mpz_end, mpz_start);
+    mpz_sub(mpz_base, mpz_end, mpz_start);
+    
+    return limit == 0 || mpz_cmp_ui(mpz_base, limit) <= 0;
+  }
+
+  const uint64_t bits = mpz_sizeinbase(mpz_start, 2);
+
+  /* log(start) = bits * log(2) */
+  const uint64_t size = (uint64_t) (bits * VERIFIER_WINDOW_MERIT * M_LN2) / 2 + 1;
+
+  uint64_t n_primes = bits * bits / VERIFIER_PRIMES_DIV;
+  if (n_primes < VERIFIER_MIN_PRIMES)
+    n_primes = VERIFIER_MIN_PRIMES;
+  if (n_primes > VERIFIER_PRIMES)
+    n_primes = VERIFIER_PRIMES;
+
+  /* the first odd number greater than start, dist is its distance */
+  uint64_t dist = mpz_odd_p(mpz_start) ? 2 : 1;
+
+  if (n_threads > 1 && bits >= VERIFIER_PARALLEL_BITS) {
+
+    verifier_search_t search;
+    mpz_init(search.mpz_first);
+    mpz_add_ui(search.mpz_first, mpz_start, dist);
+
+    /* the first prime is expected after log(start) numbers */
+    search.size      = (uint64_t) (bits * M_LN2) / (2 * n_threads) + 1;
+    search.n_primes  = n_primes;
+    search.mpz_prime = mpz_prime;
+
+    if (limit == 0)
+      search.n_candidates = UINT64_MAX;
+    else
+      search.n_candidates = (limit >= dist) ? (limit - dist) / 2 + 1 : 0;
+
+    const bool found = parallel_search(mpz_end, &search);
+    mpz_clear(search.mpz_first);
+
+    return found;
+  }
+
+  if (mpz_prime != NULL && !is_prime(mpz_prime))
+    return false;
+
+  reserve_window(size);
+  mpz_add_ui(mpz_base, mpz_start, dist);
+
+  for (;;) {
+    sieve_window(size, n_primes);
+
+    for (uint64_t j = 0; j < size; j++) {
+      if (limit > 0 && dist + 2 * j > limit)
+        return false;
+
+      if (window[j])
+        continue;
+
+      mpz_add_ui(mpz_end, mpz_base, 2 * j);
+      if (is_prime(mpz_end))
+        return true;
+    }
+
+    mpz_add_ui(mpz_base, mpz_base, 2 * size);
+    dist += 2 * size;
+  }
+}
+
+/**
+ * runs the given search on all threads
+ */
+bool Verifier::parallel_search(mpz_t mpz_end, verifier_search_t *search) {
+
+  search->next_task = (search->mpz_prime == NULL) ? 1 : 0;
+  search->found.store(search->n_candidates, std::memory_order_relaxed);
+  search->composite.store(false, std::memory_order_relaxed);
+  pthread_mutex_init(&search->lock, NULL);
+
+  for (uint32_t i = 1; i < n_threads; i++) {
+    workers[i].search  = search;
+    workers[i].running = (pthread_create(&workers[i].thread,
+                                         NULL,
+                                         verifier_worker_main,
+                                         workers + i) == 0);
+  }
+
+  run_search(search);
+
+  for (uint32_t i = 1; i < n_threads; i++) {
+    if (workers[i].running) {
+      pthread_join(workers[i].thread, NULL);
+      workers[i].running = false;
+    }
+  }
+
+  pthread_mutex_destroy(&search->lock);
+
+  /* the threads are joined, so their results are visible */
+  const uint64_t found = search->found.load(std::memory_order_relaxed);
+
+  if (search->composite.load(std::memory_order_relaxed) || 
+      found >= search->n_candidates)
+    return false;
+
+  mpz_add_ui(mpz_end, search->mpz_first, 2 * found);
+  return true;
+}
+
+/**
+ * runs the tasks of the given parallel search till it is done
+ */
+void Verifier::run_search(verifier_search_t *search) {
+
+  for (;;) {
+    pthread_mutex_lock(&search->lock);
+    const uint64_t task = search->next_task++;
+    pthread_mutex_unlock(&search->lock);
+
+    if (task == 0) {
+      if (!is_prime(search->mpz_prime))
+        search->composite.store(true, std::memory_order_relaxed);
+
+      continue;
+    }
+
+    /* chunks are taken in order, so all further ones are behind as well */
+    const uint64_t first = (task - 1) * search->size;
+    if (search->composite.load(std::memory_order_relaxed) || 
+        first >= search->found.load(std::memory_order_relaxed))
+      return;
+
+    search_chunk(search, first);
+  }
+}
+
+/**
+ * tests the candidates of the chunk starting at candidate index first
+ * up to the first prime
+ */
+void Verifier::search_chunk(verifier_search_t *search, uint64_t first) {
+
+  const uint64_t size = search->size;
+
+  reserve_window(size);
+  mpz_add_ui(mpz_base, search->mpz_first, 2 * first);
+  sieve_window(size, search->n_primes);
+
+  for (uint64_t j = 0; j < size; j++) {
+
+    /* a smaller prime was found (or the limit is reached) */
+    if (search->composite.load(std::memory_order_relaxed) || 
+        first + j >= search->found.load(std::memory_order_relaxed))
+      return;
+
+    if (window[j])
+      continue;
+
+    mpz_add_ui(mpz_candidate, mpz_base, 2 * j);
+    if (is_prime(mpz_candidate)) {
+
+      pthread_mutex_lock(&search->lock);
+      if (first + j < search->found.load(std::memory_order_relaxed))
+        search->found.store(first + j, std::memory_order_relaxed);
+      pthread_mutex_unlock(&search->lock);
+
+      return;
+    }
+  }
+}
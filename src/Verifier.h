@@ -0,0 +1,276 @@
+/**
+ * Header file of the prime search used to validate a PoW.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ */
+#ifndef __VERIFIER_H__
+#define __VERIFIER_H__
+#include <inttypes.h>
+#include <stdint.h>
+#include <pthread.h>
+#include <gmp.h>
+#include <atomic>
+
+/**
+ * maximal number of odd primes the search interval is sieved with,
+ * a start of n bits uses n^2 / VERIFIER_PRIMES_DIV of them (the cost of a 
+ * probable prime test grows faster than the one of the sieve)
+ */
+#ifndef VERIFIER_PRIMES
+#define VERIFIER_PRIMES 32768
+#endif
+#define VERIFIER_PRIMES_DIV 50
+#define VERIFIER_MIN_PRIMES 256
+
+/**
+ * a sieve window covers VERIFIER_WINDOW_MERIT * log(start) numbers
+ * (the first prime is expected after log(start) numbers)
+ */
+#define VERIFIER_WINDOW_MERIT 4
+
+/**
+ * with more than one thread the searches after starts of at least this
+ * many bits run in parallel, smaller ones are not worth the thread starts
+ */
+#ifndef VERIFIER_PARALLEL_BITS
+#define VERIFIER_PARALLEL_BITS 512
+#endif
+
+/**
+ * the probable prime test of the validation
+ */
+typedef enum {
+
+  /* mpz_probab_prime_p with 25 rounds (the test of mpz_nextprime) */
+  PRIME_TEST_MR25,
+
+  /**
+   * Baillie-PSW: a strong base 2 test and a strong Lucas test (the 
+   * extra strong variant), no composite passing both is known
+   */
+  PRIME_TEST_BPSW
+} prime_test_t;
+
+/**
+ * the default test of the validation: the one of mpz_nextprime, till
+ * BPSW is checked against PoWs of the chain (tests/VerifierCorpus.txt)
+ */
+#ifndef VERIFIER_PRIME_TEST
+#define VERIFIER_PRIME_TEST PRIME_TEST_MR25
+#endif
+
+class Verifier;
+
+/**
+ * the shared state of a parallel search: the candidates after the 
+ * start are cut into chunks, which the threads take in order
+ */
+typedef struct {
+
+  /* the first (odd) candidate */
+  mpz_t mpz_first;
+
+  /* candidates per chunk */
+  uint64_t size;
+
+  /* number of sieve primes */
+  uint32_t n_primes;
+
+  /* number of candidates up to the limit */
+  uint64_t n_candidates;
+
+  /* the number tested along the search (NULL if none) */
+  mpz_ptr mpz_prime;
+
+  /* the next task: 0 tests mpz_prime, k > 0 searches chunk k - 1 */
+  uint64_t next_task;
+
+  /**
+   * index of the smallest prime found so far (n_candidates if none),
+   * the candidates behind it are not tested any more 
+   * (written under lock, polled by the threads without it)
+   */
+  std::atomic<uint64_t> found;
+
+  /* whether mpz_prime is composite (cancels the search) */
+  std::atomic<bool> composite;
+
+  /* guards next_task and found */
+  pthread_mutex_t lock;
+} verifier_search_t;
+
+/**
+ * a thread of a parallel search
+ */
+typedef struct {
+
+  /* the instance (and scratch space) this thread searches with */
+  Verifier *verifier;
+
+  /* the current search */
+  verifier_search_t *search;
+
+  /* whether the thread was started and has to be joined */
+  bool running;
+
+  pthread_t thread;
+} verifier_worker_t;
+
+/**
+ * finds the prime gap end of a PoW: the numbers after the start are 
+ * sieved window by window with the first odd primes, only the remaining
+ * candidates get a probable prime test.
+ *
+ * With PRIME_TEST_MR25 the test is the one of mpz_nextprime 
+ * (mpz_probab_prime_p with 25 rounds only adds trial division to it),
+ * so the same prime is found. PRIME_TEST_BPSW finds the same prime
+ * unless there is a BPSW pseudo prime in between.
+ *
+ * With more than one thread the candidates are cut into chunks of 
+ * log(start) / threads numbers, which are sieved and tested in parallel.
+ * The smallest prime found so far cancels all chunks behind it, so
+ * the same prime is found as by a single thread.
+ */
+class Verifier {
+
+  public :
+
+    Verifier(prime_test_t test = VERIFIER_PRIME_TEST);
+    ~Verifier();
+
+    /**
+     * sets / returns the probable prime test
+     */
+    void set_prime_test(prime_test_t test);
+    prime_test_t get_prime_test();
+
+    /**
+     * returns whether mpz_n is a probable prime by the selected test
+     */
+    bool is_prime(mpz_t mpz_n);
+
+    /**
+     * sets mpz_end to the next probable prime greater than mpz_start
+     * (the same prime as mpz_nextprime), with limit > 0 only up to 
+     * mpz_start + limit. returns whether a prime was found
+     */
+    bool next_prime(mpz_t mpz_end, mpz_t mpz_start, uint64_t limit = 0);
+
+    /**
+     * next_prime without limit, which tests mpz_prime along the 
+     * search (concurrently with more than one thread).
+     * returns false if mpz_prime is composite
+     */
+    bool test_and_next_prime(mpz_t mpz_end, mpz_t mpz_start, mpz_t mpz_prime);
+
+    /**
+     * sets / returns the number of threads of a search 
+     * (one per online cpu if n_threads is 0)
+     */
+    void set_threads(uint32_t n_threads);
+    uint32_t get_threads();
+
+    /**
+     * runs the tasks of the given parallel search till it is done
+     */
+    void run_search(verifier_search_t *search);
+
+  private :
+
+    /* the probable prime test */
+    prime_test_t test;
+
+    /* scratch values of the BPSW test */
+    mpz_t mpz_d, mpz_x, mpz_u, mpz_v;
+
+    /* the tested candidate of a parallel search */
+    mpz_t mpz_candidate;
+
+    /* number of threads of a search */
+    uint32_t n_threads;
+
+    /* the threads, the first one is the calling thread (this instance) */
+    verifier_worker_t *workers;
+
+    /* the sieve primes (shared by all instances) */
+    static const uint32_t *primes;
+
+    /* the primes grouped by products which fit an unsigned long */
+    static const unsigned long *group_prods;
+
+    /* index of the first prime behind each group */
+    static const uint32_t *group_ends;
+
+    /* number of prime groups */
+    static uint32_t n_groups;
+
+    /* the composite flags of the window candidates */
+    uint8_t *window;
+
+    /* number of candidates the window is allocated for */
+    uint64_t max_window;
+
+    /* the first candidate of the window */
+    mpz_t mpz_base;
+
+    /**
+     * generates the sieve primes and their groups (once)
+     */
+    static void init_primes();
+
+    /**
+     * strong probable prime test to base 2 of the odd mpz_n > 2
+     */
+    bool strong_base2(mpz_t mpz_n);
+
+    /**
+     * extra strong Lucas probable prime test of the odd mpz_n > 2
+     */
+    bool strong_lucas(mpz_t mpz_n);
+
+    /**
+     * marks the composites of the size odd candidates mpz_base + 2i
+     * with the first n_primes sieve primes
+     */
+    void sieve_window(uint64_t size, uint32_t n_primes);
+
+    /**
+     * makes sure the window fits size candidates
+     */
+    void reserve_window(uint64_t size);
+
+    /**
+     * next_prime and test_and_next_prime (mpz_prime is NULL for next_prime)
+     */
+    bool search(mpz_t mpz_end, 
+                mpz_t mpz_start, 
+                uint64_t limit, 
+                mpz_t mpz_prime);
+
+    /**
+     * runs the given search on all threads, 
+     * returns whether a prime was found
+     */
+    bool parallel_search(mpz_t mpz_end, verifier_search_t *search);
+
+    /**
+     * tests the candidates of the chunk starting at candidate index first
+     * up to the first prime
+     */
+    void search_chunk(verifier_search_t *search, uint64_t first);
+};
+
+#endif /* __VERIFIER_H__ */
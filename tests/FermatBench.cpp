@@ -0,0 +1,114 @@
+/**
+ * Micro-benchmark of the base 2 Fermat test against mpz_powm.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * build (from the repository root):
+ *
+ *   g++ -O2 -Isrc tests/FermatBench.cpp src/Isa.cpp -lgmp -o fermat_bench
+ *
+ * usage: fermat_bench [shift ...] (default 14 64 128 256 384 512 768 1024)
+ *
+ * Fermat.cpp is included with FERMAT_BASE2_LIMBS 1, so the base 2 path
+ * runs for every size. Each time is the best of N_RUNS runs over the 
+ * same N_CANDIDATES consecutive odd candidates hash * 2^shift + adder.
+ */
+#define FERMAT_BASE2_LIMBS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <sys/time.h>
+#include <gmp.h>
+
+#include "../src/Fermat.cpp"
+
+#define N_RUNS 15
+#define N_CANDIDATES 64
+
+static uint64_t gettime_usec() {
+
+  struct timeval time;
+  gettimeofday(&time, NULL);
+
+  return ((uint64_t) time.tv_sec) * 1000000 + time.tv_usec;
+}
+
+int main(int argc, char **argv) {
+
+  const uint32_t default_shifts[] = { 14, 64, 128, 256, 384, 512, 768, 1024 };
+  const int n_shifts = (argc > 1) ? argc - 1 : 8;
+
+  Fermat fermat(ISA_SCALAR);
+
+  mpz_t mpz_hash, mpz_start, mpz_p, mpz_r, mpz_two;
+  mpz_init_set_str(mpz_hash, "d2b1f5a3c9e8f70112233445566778899aabbccdd"
+                             "eeff00112233445566778f1", 16);
+  mpz_init(mpz_start);
+  mpz_init(mpz_p);
+  mpz_init(mpz_r);
+  mpz_init_set_ui(mpz_two, 2);
+
+  /* keeps the results alive */
+  volatile uint32_t passed = 0;
+
+  printf("  shift  limbs  mpz_powm    base 2\n");
+
+  for (int s = 0; s < n_shifts; s++) {
+
+    const uint32_t shift = (argc > 1) ? atoi(argv[s + 1]) : default_shifts[s];
+
+    mpz_mul_2exp(mpz_start, mpz_hash, shift);
+    mpz_setbit(mpz_start, 0);
+
+    uint64_t best_powm = UINT64_MAX, best_base2 = UINT64_MAX;
+
+    for (int run = 0; run < N_RUNS; run++) {
+
+      uint64_t time = gettime_usec();
+      for (int i = 0; i < N_CANDIDATES; i++) {
+        mpz_add_ui(mpz_p, mpz_start, 2 * i);
+        mpz_powm(mpz_r, mpz_two, mpz_p, mpz_p);
+        passed += (mpz_cmp_ui(mpz_r, 2) == 0);
+      }
+      time = gettime_usec() - time;
+      if (time < best_powm)
+        best_powm = time;
+
+      time = gettime_usec();
+      for (int i = 0; i < N_CANDIDATES; i++) {
+        mpz_add_ui(mpz_p, mpz_start, 2 * i);
+        passed += fermat.fermat_test(mpz_p);
+      }
+      time = gettime_usec() - time;
+      if (time < best_base2)
+        best_base2 = time;
+    }
+
+    printf("  %5u  %5zu  %6.1f us  %6.1f us\n",
+           shift,
+           mpz_size(mpz_start),
+           ((double) best_powm) / N_CANDIDATES,
+           ((double) best_base2) / N_CANDIDATES);
+  }
+
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_start);
+  mpz_clear(mpz_p);
+  mpz_clear(mpz_r);
+  mpz_clear(mpz_two);
+
+  return 0;
+}
@@ -0,0 +1,165 @@
+/**
+ * Checks the Fermat tests of the mining sieve against mpz_powm.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * build (from the repository root):
+ *
+ *   g++ -O2 -Isrc tests/FermatTest.cpp src/Isa.cpp -lgmp -o fermat_test
+ *
+ * Fermat.cpp is included with FERMAT_BASE2_LIMBS 1, so the base 2 
+ * exponentiation is used for every size, not only from 12 limbs on.
+ * For each shift 14 till 1024 the starts hash * 2^shift + adder of
+ * random odd, prime and 2^k - 1 (pseudo primes for prime k) numbers are
+ * tested by the single and by the batched test. Returns 1 on a mismatch.
+ */
+#define FERMAT_BASE2_LIMBS 1
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <gmp.h>
+
+#include "../src/Fermat.cpp"
+
+#define MIN_SHIFT 14
+#define MAX_SHIFT 1024
+
+/* random odd numbers per shift */
+#define N_RANDOM 4
+
+/* every PRIME_STEP-th shift also tests a prime (mpz_nextprime is slow) */
+#define PRIME_STEP 8
+
+static uint64_t n_tests = 0, n_failed = 0;
+
+/**
+ * the reference: 2^(p - 1) = 1 (mod p)
+ */
+static bool powm_test(mpz_t mpz_p) {
+
+  mpz_t mpz_r, mpz_e;
+  mpz_init_set_ui(mpz_r, 2);
+  mpz_init(mpz_e);
+  mpz_sub_ui(mpz_e, mpz_p, 1);
+  mpz_powm(mpz_r, mpz_r, mpz_e, mpz_p);
+
+  const bool result = (mpz_cmp_ui(mpz_r, 1) == 0);
+  mpz_clear(mpz_r);
+  mpz_clear(mpz_e);
+
+  return result;
+}
+
+static void check(Fermat *fermat, mpz_t mpz_p, uint32_t shift) {
+
+  n_tests++;
+  if (fermat->fermat_test(mpz_p) != powm_test(mpz_p)) {
+    n_failed++;
+    gmp_printf("[EE] shift %u: base 2 test differs for %Zx\n", shift, mpz_p);
+  }
+}
+
+/**
+ * tests lanes consecutive odd numbers after mpz_start at once
+ */
+static void check_batch(Fermat *fermat, mpz_t mpz_start, uint32_t shift) {
+
+  uint64_t offsets[FERMAT_MAX_LANES];
+  bool results[FERMAT_MAX_LANES];
+  const int n = fermat->get_lanes();
+
+  for (int i = 0; i < n; i++)
+    offsets[i] = 2 * i;
+
+  fermat->fermat_test(mpz_start, offsets, results, n);
+
+  mpz_t mpz_p;
+  mpz_init(mpz_p);
+
+  for (int i = 0; i < n; i++) {
+    mpz_add_ui(mpz_p, mpz_start, offsets[i]);
+    n_tests++;
+
+    if (results[i] != powm_test(mpz_p)) {
+      n_failed++;
+      gmp_printf("[EE] shift %u: batched test differs for %Zx\n", 
+                 shift, 
+                 mpz_p);
+    }
+  }
+
+  mpz_clear(mpz_p);
+}
+
+int main() {
+
+  Fermat single(ISA_SCALAR);
+  Fermat batched(isa_detect());
+
+  gmp_randstate_t rand;
+  gmp_randinit_default(rand);
+  gmp_randseed_ui(rand, 14);
+
+  mpz_t mpz_hash, mpz_adder, mpz_p;
+  mpz_init(mpz_hash);
+  mpz_init(mpz_adder);
+  mpz_init(mpz_p);
+
+  for (uint32_t shift = MIN_SHIFT; shift <= MAX_SHIFT; shift++) {
+
+    /* hash in [2^255, 2^256) */
+    mpz_urandomb(mpz_hash, rand, 255);
+    mpz_setbit(mpz_hash, 255);
+
+    for (int i = 0; i < N_RANDOM; i++) {
+      mpz_urandomb(mpz_adder, rand, shift);
+      mpz_mul_2exp(mpz_p, mpz_hash, shift);
+      mpz_add(mpz_p, mpz_p, mpz_adder);
+      mpz_setbit(mpz_p, 0);
+
+      check(&single, mpz_p, shift);
+
+      if (i == 0)
+        check_batch(&batched, mpz_p, shift);
+    }
+
+    if (shift % PRIME_STEP == 0) {
+      mpz_nextprime(mpz_p, mpz_p);
+      check(&single, mpz_p, shift);
+      check_batch(&batched, mpz_p, shift);
+    }
+
+    /* 2^k - 1 passes for prime k */
+    mpz_set_ui(mpz_p, 0);
+    mpz_setbit(mpz_p, 256 + shift);
+    mpz_sub_ui(mpz_p, mpz_p, 1);
+    check(&single, mpz_p, shift);
+  }
+
+  printf("fermat: %s (%" PRIu64 " tests, %" PRIu64 " failed, %s lanes %d)\n",
+         n_failed ? "FAILED" : "PASSED",
+         n_tests,
+         n_failed,
+         isa_name(isa_detect()),
+         batched.get_lanes());
+
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_adder);
+  mpz_clear(mpz_p);
+  gmp_randclear(rand);
+
+  return n_failed ? 1 : 0;
+}
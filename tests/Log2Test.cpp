@@ -0,0 +1,278 @@
+/**
+ * Checks the fixed point log2 of PoWUtils against the exact calculation.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * build (from the repository root, PoWUtils.h needs -fpermissive with
+ * current g++):
+ *
+ *   g++ -O2 -fpermissive -Isrc tests/Log2Test.cpp -lmpfr -lgmp -lcrypto \
+ *       -o log2_test
+ *
+ * PoWUtils.cpp is included, so fast_log2 is tested on its own and
+ * through PoWUtils::mpz_log2, both against the former mpz_log2
+ * (ref_log2 below, the squaring loop on the whole number):
+ *
+ *   - N_RANDOM random and sparse starts hash * 2^shift + adder
+ *     for every shift 14 till 1024
+ *   - the numbers around 2^k for every size of these starts
+ *   - numbers with a log2 just next to one with few fractional bits
+ *     (the k / 2^s roots of 2^L), which have to fall back to ref_log2
+ *   - random numbers of 1 till 2400 bits with accuracies of 1 till 64
+ *     (including the ones too small for fast_log2)
+ *
+ * Returns 1 on a mismatch, or if no number fell back.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <gmp.h>
+
+#include "../src/PoWUtils.cpp"
+
+#ifndef FAST_LOG2
+#error "fast_log2 needs a 64 bit build with 128 bit integers"
+#endif
+
+#define MIN_SHIFT 14
+#define MAX_SHIFT 1024
+
+/* random starts per shift */
+#define N_RANDOM 16
+
+/* numbers next to the roots 2^(L + k / 2^s) */
+#define N_ROOTS 4000
+
+/* random numbers of any size */
+#define N_ANY 100000
+
+static uint64_t n_tests = 0, n_failed = 0, n_fallbacks = 0;
+
+/**
+ * the former PoWUtils::mpz_log2 (verbatim)
+ */
+static void ref_log2(mpz_t mpz_log, mpz_t mpz_src, uint32_t accuracy) {
+
+  mpz_t mpz_tmp, mpz_n;
+  mpz_init(mpz_tmp);
+  mpz_init_set(mpz_n, mpz_src);
+
+  /* log2 without the decimal part */
+  mpz_set_ui64(mpz_log, mpz_sizeinbase(mpz_n, 2) - 1);
+
+  uint32_t bits = 0;
+  uint32_t shift = accuracy + mpz_get_ui64(mpz_log);
+
+  /* add accuracy bits */
+  mpz_mul_2exp(mpz_log, mpz_log, accuracy);
+  mpz_mul_2exp(mpz_n,   mpz_n,   accuracy);
+
+  for (;;) {
+
+    mpz_div_2exp(mpz_tmp, mpz_n, shift);
+
+    /* while n / 2^accuracy < 2 */
+    while (mpz_get_ui64(mpz_tmp) < 2 && bits <= accuracy) {
+
+      /* n = n^2 */
+      mpz_mul(mpz_n, mpz_n, mpz_n);
+
+      /* preserve accuracy */
+      mpz_div_2exp(mpz_n, mpz_n, shift);
+      mpz_div_2exp(mpz_tmp, mpz_n, shift);
+
+      bits++;
+    }
+
+    if (bits > accuracy) break;
+
+    /* log += 2^(accuracy - bits) */
+    mpz_set_ui64(mpz_tmp, 1);
+    mpz_mul_2exp(mpz_tmp, mpz_tmp, accuracy - bits);
+    mpz_add(mpz_log, mpz_log, mpz_tmp);
+
+    /* n = n / 2 */
+    mpz_div_2exp(mpz_n, mpz_n, 1);
+  }
+
+  mpz_clear(mpz_tmp);
+  mpz_clear(mpz_n);
+}
+
+/**
+ * compares fast_log2 (if it decides) and PoWUtils::mpz_log2
+ * with ref_log2, returns whether fast_log2 fell back
+ */
+static bool check(PoWUtils *utils, mpz_t mpz_n, uint32_t accuracy) {
+
+  mpz_t mpz_ref, mpz_log;
+  mpz_init(mpz_ref);
+  mpz_init(mpz_log);
+
+  ref_log2(mpz_ref, mpz_n, accuracy);
+  n_tests++;
+
+  const bool fallback = !fast_log2(mpz_log, mpz_n, accuracy);
+
+  if (fallback)
+    n_fallbacks++;
+  else if (mpz_cmp(mpz_log, mpz_ref) != 0) {
+    n_failed++;
+    gmp_printf("[EE] accuracy %u: fast_log2 differs for %Zx\n",
+               accuracy,
+               mpz_n);
+  }
+
+  utils->mpz_log2(mpz_log, mpz_n, accuracy);
+  if (mpz_cmp(mpz_log, mpz_ref) != 0) {
+    n_failed++;
+    gmp_printf("[EE] accuracy %u: mpz_log2 differs for %Zx\n",
+               accuracy,
+               mpz_n);
+  }
+
+  mpz_clear(mpz_ref);
+  mpz_clear(mpz_log);
+
+  return fallback;
+}
+
+/**
+ * checks 2^k + d for d in [-3, 3]
+ */
+static void check_power(PoWUtils *utils, mpz_t mpz_n, uint32_t k) {
+
+  for (int d = -3; d <= 3; d++) {
+    mpz_set_ui(mpz_n, 1);
+    mpz_mul_2exp(mpz_n, mpz_n, k);
+
+    if (d < 0)
+      mpz_sub_ui(mpz_n, mpz_n, -d);
+    else
+      mpz_add_ui(mpz_n, mpz_n, d);
+
+    if (mpz_sgn(mpz_n) > 0)
+      check(utils, mpz_n, 64);
+  }
+}
+
+int main() {
+
+  PoWUtils utils;
+
+  gmp_randstate_t rand;
+  gmp_randinit_default(rand);
+  gmp_randseed_ui(rand, 2);
+
+  mpz_t mpz_hash, mpz_adder, mpz_n, mpz_r;
+  mpz_init(mpz_hash);
+  mpz_init(mpz_adder);
+  mpz_init(mpz_n);
+  mpz_init(mpz_r);
+
+  for (uint32_t shift = MIN_SHIFT; shift <= MAX_SHIFT; shift++) {
+
+    for (int i = 0; i < N_RANDOM; i++) {
+
+      /* hash in [2^255, 2^256), every second one with long runs of bits */
+      if (i & 1)
+        mpz_rrandomb(mpz_hash, rand, 255);
+      else
+        mpz_urandomb(mpz_hash, rand, 255);
+
+      mpz_setbit(mpz_hash, 255);
+      mpz_urandomb(mpz_adder, rand, shift);
+
+      mpz_mul_2exp(mpz_n, mpz_hash, shift);
+      mpz_add(mpz_n, mpz_n, mpz_adder);
+      check(&utils, mpz_n, 64);
+    }
+
+    /* starts of 256 + shift bits are in [2^(255 + shift), 2^(256 + shift)) */
+    check_power(&utils, mpz_n, 255 + shift);
+  }
+
+  printf("shifts %u till %u: %" PRIu64 " tests\n",
+         MIN_SHIFT,
+         MAX_SHIFT,
+         n_tests);
+
+  /**
+   * log2(root) = L + k / 2^s has at most s fractional bits, the bits
+   * behind them are 0 for the root and its upper neighbours and 1 for
+   * the lower ones, so an interval around it can not decide them
+   */
+  uint64_t root_fallbacks = 0;
+  for (int i = 0; i < N_ROOTS; i++) {
+
+    const uint32_t s = 1 + gmp_urandomm_ui(rand, 11);
+    const uint32_t L = 255 + MIN_SHIFT +
+                       gmp_urandomm_ui(rand, MAX_SHIFT - MIN_SHIFT + 1);
+    const unsigned long k = 1 + gmp_urandomm_ui(rand, (1ul << s) - 1);
+
+    mpz_set_ui(mpz_r, 1);
+    mpz_mul_2exp(mpz_r, mpz_r, (((uint64_t) L) << s) + k);
+    mpz_root(mpz_r, mpz_r, 1ul << s);
+
+    for (int d = -2; d <= 2; d++) {
+      if (d < 0)
+        mpz_sub_ui(mpz_n, mpz_r, -d);
+      else
+        mpz_add_ui(mpz_n, mpz_r, d);
+
+      root_fallbacks += check(&utils, mpz_n, 64);
+    }
+  }
+
+  printf("roots: %" PRIu64 " fallbacks of %d tests\n",
+         root_fallbacks,
+         5 * N_ROOTS);
+
+  const uint32_t accuracies[] = { 64, 63, 48, 32, 16, 1 };
+  const uint32_t n_accuracies = sizeof(accuracies) / sizeof(accuracies[0]);
+
+  for (int i = 0; i < N_ANY; i++) {
+
+    const uint32_t bits = 1 + gmp_urandomm_ui(rand, 2400);
+    if (i & 1)
+      mpz_rrandomb(mpz_n, rand, bits);
+    else
+      mpz_urandomb(mpz_n, rand, bits);
+
+    if (mpz_sgn(mpz_n) == 0)
+      mpz_set_ui(mpz_n, 1);
+
+    check(&utils, mpz_n, accuracies[i % n_accuracies]);
+  }
+
+  for (uint32_t k = 0; k < 2400; k++)
+    check_power(&utils, mpz_n, k);
+
+  printf("log2: %s (%" PRIu64 " tests, %" PRIu64 " fallbacks, "
+         "%" PRIu64 " failed)\n",
+         (n_failed || !root_fallbacks) ? "FAILED" : "PASSED",
+         n_tests,
+         n_fallbacks,
+         n_failed);
+
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_adder);
+  mpz_clear(mpz_n);
+  mpz_clear(mpz_r);
+  gmp_randclear(rand);
+
+  return (n_failed || !root_fallbacks) ? 1 : 0;
+}
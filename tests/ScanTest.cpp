@@ -0,0 +1,256 @@
+/**
+ * Checks the gaps reported by the gap scan of the mining sieve against
+ * the prime gaps of the window.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * build (from the repository root, PoWUtils.h needs -fpermissive with
+ * current g++):
+ *
+ *   g++ -O2 -fpermissive -Isrc tests/ScanTest.cpp src/Sieve.cpp \
+ *       src/Fermat.cpp src/Isa.cpp src/PoW.cpp src/PoWUtils.cpp \
+ *       src/Verifier.cpp -lmpfr -lgmp -lcrypto -lpthread -o scan_test
+ *
+ * The target is a merit of TARGET_MERIT, low enough that many gaps of a
+ * window are at least 2 * min_len + 2 long (which the scan once reported
+ * again and again). For each shift, layout and segment size, WINDOWS
+ * windows are sieved and scanned. Each gap the scan reports has to meet
+ * the target and must be reported only once. Each gap meeting the target
+ * has to be reported, if it is at least min_len + 2 long (shorter ones
+ * can only meet the target by the random part of the difficulty, the
+ * scan skips them) and its start is at least min_len + 2 below the 
+ * window end (the scan of a window does not look beyond it). The gaps
+ * are taken from mpz_nextprime. Returns 1 on a mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <inttypes.h>
+#include <gmp.h>
+#include <set>
+
+#include "Sieve.h"
+
+using namespace std;
+
+#define TARGET_MERIT 2
+
+/* windows per sieve and number of sieve primes */
+#define WINDOWS 2
+#define N_PRIMES 100000
+
+static uint64_t n_tests = 0, n_failed = 0;
+
+/**
+ * collects the adders of the reported gaps
+ */
+class ScanProcessor : public PoWProcessor {
+
+  public:
+
+    set<uint64_t> adders;
+    uint64_t n_repeated;
+
+    ScanProcessor() : n_repeated(0) { }
+
+    bool process(PoW *pow) {
+
+      mpz_t mpz_adder;
+      mpz_init(mpz_adder);
+      pow->get_adder(mpz_adder);
+
+      /* a repeated gap would be reported forever, so stop there */
+      const bool repeated = !adders.insert(mpz_get_ui(mpz_adder)).second;
+      if (repeated)
+        n_repeated++;
+
+      mpz_clear(mpz_adder);
+      return repeated;
+    }
+};
+
+/**
+ * sieves and scans WINDOWS windows with the given layout and segment
+ * size, and compares the reported gaps with the expected ones
+ */
+static void check_scan(mpz_t mpz_hash,
+                       uint16_t shift,
+                       uint64_t sievesize,
+                       sieve_layout_t layout,
+                       uint64_t segment_size,
+                       const set<uint64_t> *expected,
+                       const set<uint64_t> *valid) {
+
+  ScanProcessor processor;
+  PoW pow(mpz_hash, shift, NULL, ((uint64_t) TARGET_MERIT) << 48);
+
+  Sieve sieve(&processor, N_PRIMES, sievesize, layout);
+  sieve.set_segment_size(segment_size);
+
+  if (sieve.get_sievesize() != sievesize) {
+    n_failed++;
+    printf("[EE] sieve size %" PRIu64 " is rounded\n", sievesize);
+    return;
+  }
+
+  mpz_t mpz_offset;
+  mpz_init_set_ui(mpz_offset, 0);
+
+  sieve.run_sieve(&pow, mpz_offset);
+  for (int w = 1; w < WINDOWS; w++)
+    sieve.run_sieve_next(&pow);
+
+  mpz_clear(mpz_offset);
+
+  uint64_t n_missing = 0, n_invalid = 0;
+  for (set<uint64_t>::const_iterator it = expected->begin();
+       it != expected->end();
+       ++it) {
+    n_missing += !processor.adders.count(*it);
+  }
+
+  for (set<uint64_t>::const_iterator it = processor.adders.begin();
+       it != processor.adders.end();
+       ++it) {
+    n_invalid += !valid->count(*it);
+  }
+
+  n_tests++;
+  if (n_missing || n_invalid || processor.n_repeated) {
+    n_failed++;
+    printf("[EE] shift %u, %s layout, segment size %" PRIu64 ": "
+           "%" PRIu64 " missing, %" PRIu64 " invalid, "
+           "%" PRIu64 " repeated gaps\n",
+           shift,
+           (layout == SIEVE_WHEEL30) ? "wheel" : "odd",
+           segment_size,
+           n_missing,
+           n_invalid,
+           processor.n_repeated);
+  }
+}
+
+/**
+ * collects the adders of the gaps meeting the target within the windows:
+ * valid gets all of them, expected the ones the scan has to report
+ */
+static void find_gaps(mpz_t mpz_hash,
+                      uint16_t shift,
+                      uint64_t sievesize,
+                      set<uint64_t> *expected,
+                      set<uint64_t> *valid,
+                      uint64_t *n_long) {
+
+  PoW pow(mpz_hash, shift, NULL, ((uint64_t) TARGET_MERIT) << 48);
+  PoWUtils utils;
+
+  mpz_t mpz_base, mpz_start, mpz_p, mpz_q;
+  mpz_init(mpz_base);
+  mpz_init(mpz_start);
+  mpz_init(mpz_p);
+  mpz_init(mpz_q);
+  mpz_mul_2exp(mpz_base, mpz_hash, shift);
+
+  for (uint64_t w = 0; w < WINDOWS; w++) {
+
+    /* the window [first, first + sievesize) and its min_len */
+    const uint64_t first = w * sievesize;
+    mpz_add_ui(mpz_start, mpz_base, first);
+    const uint64_t min_len = pow.target_size(mpz_start) & ~((uint64_t) 1);
+
+    mpz_sub_ui(mpz_p, mpz_start, 1);
+    mpz_nextprime(mpz_p, mpz_p);
+
+    for (;;) {
+
+      mpz_sub(mpz_start, mpz_p, mpz_base);
+      const uint64_t adder = mpz_get_ui(mpz_start);
+      if (adder >= first + sievesize)
+        break;
+
+      mpz_nextprime(mpz_q, mpz_p);
+
+      mpz_sub(mpz_start, mpz_q, mpz_p);
+      const uint64_t len = mpz_get_ui(mpz_start);
+
+      if (utils.difficulty(mpz_p, mpz_q) >= pow.get_target()) {
+        valid->insert(adder);
+
+        if (len >= min_len + 2 && adder + min_len + 2 < first + sievesize)
+          expected->insert(adder);
+      }
+
+      if (len >= 2 * min_len + 2)
+        (*n_long)++;
+
+      mpz_set(mpz_p, mpz_q);
+    }
+  }
+
+  mpz_clear(mpz_base);
+  mpz_clear(mpz_start);
+  mpz_clear(mpz_p);
+  mpz_clear(mpz_q);
+}
+
+int main() {
+
+  mpz_t mpz_hash;
+  mpz_init_set_str(mpz_hash,
+                   "d2b1f5a3c9e8f70112233445566778899aabbccddeeff0011223344"
+                   "5566778f1",
+                   16);
+
+  /** 
+   * the windows have to stay below 2^shift, the sieve sizes are 
+   * multiples of 3840 (not rounded by either layout)
+   */
+  const uint16_t shifts[]     = { 20, 64, 300 };
+  const uint64_t sievesizes[] = { 64 * 3840, 256 * 3840, 256 * 3840 };
+  const uint64_t segment_sizes[] = { 0, 4096, 65536 };
+
+  for (uint32_t s = 0; s < sizeof(shifts) / sizeof(shifts[0]); s++) {
+
+    set<uint64_t> expected, valid;
+    uint64_t n_long = 0;
+    find_gaps(mpz_hash, shifts[s], sievesizes[s], &expected, &valid, &n_long);
+
+    printf("shift %u: %zu gaps meet the target, %" PRIu64 " long gaps\n",
+           shifts[s],
+           valid.size(),
+           n_long);
+
+    for (int l = 0; l < 2; l++) {
+      for (uint32_t g = 0; g < sizeof(segment_sizes) / sizeof(uint64_t); g++) {
+        check_scan(mpz_hash,
+                   shifts[s],
+                   sievesizes[s],
+                   l ? SIEVE_WHEEL30 : SIEVE_ODD,
+                   segment_sizes[g],
+                   &expected,
+                   &valid);
+      }
+    }
+  }
+
+  printf("scan: %s (%" PRIu64 " tests, %" PRIu64 " failed)\n",
+         n_failed ? "FAILED" : "PASSED",
+         n_tests,
+         n_failed);
+
+  mpz_clear(mpz_hash);
+
+  return n_failed ? 1 : 0;
+}
@@ -0,0 +1,255 @@
+/**
+ * Checks the BPSW test of the Verifier against mpz_probab_prime_p and
+ * its prime search against mpz_nextprime.
+ *
+ * Copyright (C)  2014  Jonny Frey  <j0nn9.fr39@gmail.com>
+ *
+ * This program is free software: you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation, either version 3 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License
+ * along with this program.  If not, see <http://www.gnu.org/licenses/>.
+ *
+ * build and run (from the repository root):
+ *
+ *   g++ -O2 -Isrc tests/VerifierTest.cpp src/Verifier.cpp -lgmp -lpthread \
+ *       -o verifier_test
+ *   ./verifier_test [corpus] (default tests/VerifierCorpus.txt)
+ *
+ * Every number of the corpus (pseudo primes of both halfs of the test,
+ * Carmichael numbers, primes and PoW starts) must get its label from
+ * PRIME_TEST_BPSW and mpz_probab_prime_p with 25 rounds, and the next
+ * prime after it must be the one of mpz_nextprime, with one and with
+ * N_THREADS threads. Then all numbers below 2^SMALL_BITS and random
+ * odd numbers, semi primes, squares and prime searches of the PoW sizes
+ * are compared. Returns 1 on a mismatch.
+ */
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <inttypes.h>
+#include <gmp.h>
+
+#include "Verifier.h"
+
+/* all numbers below 2^SMALL_BITS are compared */
+#define SMALL_BITS 20
+
+/* random numbers and prime searches per size */
+#define N_RANDOM 200
+#define N_SEARCHES 4
+
+/* threads of the parallel searches */
+#define N_THREADS 4
+
+static uint64_t n_tests = 0, n_failed = 0;
+
+static void fail(const char *what, mpz_t mpz_n) {
+  n_failed++;
+  gmp_printf("[EE] %s: %Zd\n", what, mpz_n);
+}
+
+/**
+ * compares the test of verifier on mpz_n with mpz_probab_prime_p
+ * (and with the expected result if expected >= 0)
+ */
+static void check_test(Verifier *verifier, mpz_t mpz_n, int expected) {
+
+  const bool reference = (mpz_probab_prime_p(mpz_n, 25) != 0);
+
+  n_tests++;
+  if (expected >= 0 && reference != (expected != 0))
+    fail("wrong label (mpz_probab_prime_p)", mpz_n);
+
+  if (verifier->is_prime(mpz_n) != reference)
+    fail("test differs from mpz_probab_prime_p", mpz_n);
+}
+
+/**
+ * compares the next prime after mpz_start of verifier (and of
+ * test_and_next_prime with parallel, testing mpz_prime) with mpz_nextprime
+ */
+static void check_search(Verifier *verifier,
+                         Verifier *parallel,
+                         mpz_t mpz_start,
+                         mpz_t mpz_prime) {
+
+  mpz_t mpz_ref, mpz_end;
+  mpz_init(mpz_ref);
+  mpz_init(mpz_end);
+  mpz_nextprime(mpz_ref, mpz_start);
+
+  n_tests++;
+  verifier->next_prime(mpz_end, mpz_start);
+  if (mpz_cmp(mpz_end, mpz_ref) != 0)
+    fail("next prime differs from mpz_nextprime after", mpz_start);
+
+  mpz_set_ui(mpz_end, 0);
+  const bool prime = parallel->test_and_next_prime(mpz_end,
+                                                   mpz_start,
+                                                   mpz_prime);
+
+  if (prime != (mpz_probab_prime_p(mpz_prime, 25) != 0))
+    fail("parallel test differs from mpz_probab_prime_p", mpz_prime);
+  else if (prime && mpz_cmp(mpz_end, mpz_ref) != 0)
+    fail("parallel next prime differs from mpz_nextprime after", mpz_start);
+
+  mpz_clear(mpz_ref);
+  mpz_clear(mpz_end);
+}
+
+/**
+ * checks the entries of the corpus file, returns false if it can
+ * not be read
+ */
+static bool check_corpus(Verifier *verifier,
+                         Verifier *parallel,
+                         const char *path) {
+
+  FILE *file = fopen(path, "r");
+  if (file == NULL) {
+    printf("[EE] can not open %s\n", path);
+    return false;
+  }
+
+  mpz_t mpz_n, mpz_start, mpz_hash, mpz_adder;
+  mpz_init(mpz_n);
+  mpz_init(mpz_start);
+  mpz_init(mpz_hash);
+  mpz_init(mpz_adder);
+
+  char line[4096], kind[16], value[2048], adder[2048];
+  unsigned shift;
+  uint32_t n_entries = 0;
+
+  while (fgets(line, sizeof(line), file) != NULL) {
+
+    if (line[0] == '#' || sscanf(line, "%15s", kind) != 1)
+      continue;
+
+    n_entries++;
+    if (!strcmp(kind, "pow") &&
+        sscanf(line, "%*s %2047s %u %2047s", value, &shift, adder) == 3 &&
+        mpz_set_str(mpz_hash, value, 16) == 0 &&
+        mpz_set_str(mpz_adder, adder, 16) == 0) {
+
+      /* start = hash * 2^shift + adder */
+      mpz_mul_2exp(mpz_n, mpz_hash, shift);
+      mpz_add(mpz_n, mpz_n, mpz_adder);
+
+      check_test(verifier, mpz_n, 1);
+      check_search(verifier, parallel, mpz_n, mpz_n);
+
+    } else if ((!strcmp(kind, "prime") || !strcmp(kind, "composite")) &&
+               sscanf(line, "%*s %2047s", value) == 1 &&
+               mpz_set_str(mpz_n, value, 0) == 0) {
+
+      check_test(verifier, mpz_n, !strcmp(kind, "prime"));
+
+      /* a pseudo prime accepted by the search would end it early */
+      mpz_sub_ui(mpz_start, mpz_n, 1);
+      check_search(verifier, parallel, mpz_start, mpz_n);
+
+    } else {
+      n_failed++;
+      printf("[EE] %s: invalid line %s", path, line);
+    }
+  }
+
+  printf("corpus: %u entries\n", n_entries);
+
+  fclose(file);
+  mpz_clear(mpz_n);
+  mpz_clear(mpz_start);
+  mpz_clear(mpz_hash);
+  mpz_clear(mpz_adder);
+
+  return true;
+}
+
+int main(int argc, char *argv[]) {
+
+  const char *corpus = (argc > 1) ? argv[1] : "tests/VerifierCorpus.txt";
+
+  Verifier verifier(PRIME_TEST_BPSW);
+  Verifier parallel(PRIME_TEST_BPSW);
+  parallel.set_threads(N_THREADS);
+
+  if (!check_corpus(&verifier, &parallel, corpus))
+    return 1;
+
+  mpz_t mpz_n, mpz_p, mpz_q;
+  mpz_init(mpz_n);
+  mpz_init(mpz_p);
+  mpz_init(mpz_q);
+
+  for (uint32_t i = 0; i < (1u << SMALL_BITS); i++) {
+    mpz_set_ui(mpz_n, i);
+    check_test(&verifier, mpz_n, -1);
+  }
+
+  gmp_randstate_t rand;
+  gmp_randinit_default(rand);
+  gmp_randseed_ui(rand, 25);
+
+  /* sizes of PoW starts (a 256 bit hash shifted by 14 till 1024) */
+  const uint32_t sizes[] = { 64, 128, 270, 320, 512, 768, 1024, 1280 };
+
+  for (uint32_t s = 0; s < sizeof(sizes) / sizeof(sizes[0]); s++) {
+
+    const uint32_t bits = sizes[s];
+
+    for (int i = 0; i < N_RANDOM; i++) {
+
+      /* odd numbers */
+      mpz_urandomb(mpz_n, rand, bits);
+      mpz_setbit(mpz_n, bits - 1);
+      mpz_setbit(mpz_n, 0);
+      check_test(&verifier, mpz_n, -1);
+
+      /* semi primes p q with q = 2p - 1 when possible */
+      mpz_urandomb(mpz_p, rand, bits / 2);
+      mpz_setbit(mpz_p, bits / 2 - 1);
+      mpz_nextprime(mpz_p, mpz_p);
+      mpz_mul_2exp(mpz_q, mpz_p, 1);
+      mpz_sub_ui(mpz_q, mpz_q, 1);
+      if (!mpz_probab_prime_p(mpz_q, 25))
+        mpz_nextprime(mpz_q, mpz_q);
+
+      mpz_mul(mpz_n, mpz_p, mpz_q);
+      check_test(&verifier, mpz_n, 0);
+
+      /* squares */
+      mpz_mul(mpz_n, mpz_p, mpz_p);
+      check_test(&verifier, mpz_n, 0);
+    }
+
+    for (int i = 0; i < N_SEARCHES; i++) {
+      mpz_urandomb(mpz_n, rand, bits);
+      mpz_setbit(mpz_n, bits - 1);
+      mpz_nextprime(mpz_p, mpz_n);
+
+      check_test(&verifier, mpz_p, 1);
+      check_search(&verifier, &parallel, mpz_p, mpz_p);
+    }
+  }
+
+  printf("verifier: %s (%" PRIu64 " tests, %" PRIu64 " failed)\n",
+         n_failed ? "FAILED" : "PASSED",
+         n_tests,
+         n_failed);
+
+  mpz_clear(mpz_n);
+  mpz_clear(mpz_p);
+  mpz_clear(mpz_q);
+  gmp_randclear(rand);
+
+  return n_failed ? 1 : 0;
+}